@@ -0,0 +1,2355 @@
+#include "Gameboy.h"
+#include <iostream>
+#include <algorithm>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Opcode dispatch engine, selected with -DGB_DISPATCH=<engine>
+//   GB_DISPATCH_SWITCH : one switch over all opcodes (reference)
+//   GB_DISPATCH_TABLE  : table of per-opcode handler pointers
+//   GB_DISPATCH_GOTO   : direct threaded code with computed goto (GCC/Clang only)
+#define GB_DISPATCH_SWITCH	(0)
+#define GB_DISPATCH_TABLE	(1)
+#define GB_DISPATCH_GOTO	(2)
+
+#ifndef GB_DISPATCH
+#if defined(__GNUC__)
+#define GB_DISPATCH GB_DISPATCH_GOTO
+#else
+#define GB_DISPATCH GB_DISPATCH_TABLE
+#endif
+#endif
+
+#if GB_DISPATCH == GB_DISPATCH_GOTO && !defined(__GNUC__)
+#error "GB_DISPATCH_GOTO needs the labels-as-values extension"
+#endif
+
+// Condition flags. With GB_LAZY_FLAGS the ALU only records its operands
+// and Z/N/H are computed when an instruction reads them. C is always kept
+// up to date. GB_LAZY_FLAGS_CHECK also computes the flags eagerly and
+// stops the CPU when both disagree.
+#ifndef GB_LAZY_FLAGS
+#define GB_LAZY_FLAGS (0)
+#endif
+#ifndef GB_LAZY_FLAGS_CHECK
+#define GB_LAZY_FLAGS_CHECK (0)
+#endif
+#define GB_EAGER_FLAGS (!GB_LAZY_FLAGS || GB_LAZY_FLAGS_CHECK)
+
+// Straight-line code is decoded once into blocks of handler pointers and
+// operands, cached per (ROM bank, PC). RAM blocks are dropped when their
+// chunk is written.
+#ifndef GB_BLOCK_CACHE
+#define GB_BLOCK_CACHE (1)
+#endif
+
+// Execution profile per opcode, CB opcode and (bank, PC), fed to the
+// Profiler passed to set_profiler. Instructions run one by one while it is
+// compiled in, so every PC is attributed.
+#ifndef GB_PROFILE
+#define GB_PROFILE (0)
+#endif
+
+#define GB_FOR_EACH_OPCODE(X) \
+	X(00) X(01) X(02) X(03) X(04) X(05) X(06) X(07) X(08) X(09) X(0A) X(0B) X(0C) X(0D) X(0E) X(0F) \
+	X(10) X(11) X(12) X(13) X(14) X(15) X(16) X(17) X(18) X(19) X(1A) X(1B) X(1C) X(1D) X(1E) X(1F) \
+	X(20) X(21) X(22) X(23) X(24) X(25) X(26) X(27) X(28) X(29) X(2A) X(2B) X(2C) X(2D) X(2E) X(2F) \
+	X(30) X(31) X(32) X(33) X(34) X(35) X(36) X(37) X(38) X(39) X(3A) X(3B) X(3C) X(3D) X(3E) X(3F) \
+	X(40) X(41) X(42) X(43) X(44) X(45) X(46) X(47) X(48) X(49) X(4A) X(4B) X(4C) X(4D) X(4E) X(4F) \
+	X(50) X(51) X(52) X(53) X(54) X(55) X(56) X(57) X(58) X(59) X(5A) X(5B) X(5C) X(5D) X(5E) X(5F) \
+	X(60) X(61) X(62) X(63) X(64) X(65) X(66) X(67) X(68) X(69) X(6A) X(6B) X(6C) X(6D) X(6E) X(6F) \
+	X(70) X(71) X(72) X(73) X(74) X(75) X(76) X(77) X(78) X(79) X(7A) X(7B) X(7C) X(7D) X(7E) X(7F) \
+	X(80) X(81) X(82) X(83) X(84) X(85) X(86) X(87) X(88) X(89) X(8A) X(8B) X(8C) X(8D) X(8E) X(8F) \
+	X(90) X(91) X(92) X(93) X(94) X(95) X(96) X(97) X(98) X(99) X(9A) X(9B) X(9C) X(9D) X(9E) X(9F) \
+	X(A0) X(A1) X(A2) X(A3) X(A4) X(A5) X(A6) X(A7) X(A8) X(A9) X(AA) X(AB) X(AC) X(AD) X(AE) X(AF) \
+	X(B0) X(B1) X(B2) X(B3) X(B4) X(B5) X(B6) X(B7) X(B8) X(B9) X(BA) X(BB) X(BC) X(BD) X(BE) X(BF) \
+	X(C0) X(C1) X(C2) X(C3) X(C4) X(C5) X(C6) X(C7) X(C8) X(C9) X(CA) X(CB) X(CC) X(CD) X(CE) X(CF) \
+	X(D0) X(D1) X(D2) X(D3) X(D4) X(D5) X(D6) X(D7) X(D8) X(D9) X(DA) X(DB) X(DC) X(DD) X(DE) X(DF) \
+	X(E0) X(E1) X(E2) X(E3) X(E4) X(E5) X(E6) X(E7) X(E8) X(E9) X(EA) X(EB) X(EC) X(ED) X(EE) X(EF) \
+	X(F0) X(F1) X(F2) X(F3) X(F4) X(F5) X(F6) X(F7) X(F8) X(F9) X(FA) X(FB) X(FC) X(FD) X(FE) X(FF)
+
+static const uint8_t OP_CYCLES[0x100] = {
+	//   0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
+	4,12, 8, 8, 4, 4, 8, 4,20, 8, 8, 8, 4, 4, 8, 4,    // 0x00
+	4,12, 8, 8, 4, 4, 8, 4, 8, 8, 8, 8, 4, 4, 8, 4,    // 0x10
+	8,12, 8, 8, 4, 4, 8, 4, 8, 8, 8, 8, 4, 4, 8, 4,    // 0x20
+	8,12, 8, 8,12,12,12, 4, 8, 8, 8, 8, 4, 4, 8, 4,    // 0x30
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,    // 0x40
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,    // 0x50
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,    // 0x60
+	8, 8, 8, 8, 8, 8, 4, 8, 4, 4, 4, 4, 4, 4, 8, 4,    // 0x70
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,    // 0x80
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,    // 0x90
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,    // 0xA0
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,    // 0xB0
+	8,12,12,12,12,16, 8,32, 8, 8,12, 8,12,12, 8,32,    // 0xC0
+	8,12,12, 0,12,16, 8,32, 8, 8,12, 0,12, 0, 8,32,    // 0xD0
+	12,12, 8, 0, 0,16, 8,32,16, 4,16, 0, 0, 0, 8,32,    // 0xE0
+	12,12, 8, 4, 0,16, 8,32,12, 8,16, 4, 0, 0, 8,32     // 0xF0
+};
+
+enum NH_OP : uint8_t {
+	NH_CONST,	// N and H are stored in nh_a and nh_b
+	NH_ADD,
+	NH_SUB,
+	NH_INC,
+	NH_DEC
+};
+
+inline uint8_t CPU::flag_z()
+{
+#if GB_LAZY_FLAGS
+	uint8_t z = (zres == 0);
+	check_flag(z, FZ, "Z");
+	return z;
+#else
+	return FZ;
+#endif
+}
+
+inline uint8_t CPU::flag_n()
+{
+#if GB_LAZY_FLAGS
+	uint8_t n = (nh_op == NH_CONST) ? nh_a : (nh_op == NH_SUB || nh_op == NH_DEC);
+	check_flag(n, FN, "N");
+	return n;
+#else
+	return FN;
+#endif
+}
+
+inline uint8_t CPU::flag_h()
+{
+#if GB_LAZY_FLAGS
+	uint8_t h;
+	switch (nh_op) {
+	case NH_ADD:
+	case NH_SUB: h = ((nh_a ^ nh_b ^ nh_res) & 0x10) ? 1 : 0; break;
+	case NH_INC: h = ((nh_res & 0x0F) == 0x00); break;
+	case NH_DEC: h = ((nh_res & 0x0F) == 0x0F); break;
+	default: h = nh_b; break;
+	}
+	check_flag(h, FH, "H");
+	return h;
+#else
+	return FH;
+#endif
+}
+
+inline uint8_t CPU::flag_c()
+{
+	return FC;
+}
+
+inline void CPU::check_flag(uint8_t lazy, uint8_t eager, const char* name)
+{
+#if GB_LAZY_FLAGS_CHECK
+	if (lazy != eager) {
+		std::cout << "lazy flag " << name << " mismatch : " << (int)lazy << " != " << (int)eager << std::endl;
+		dump_reg();
+		error = true;
+		run_end = 0;
+	}
+#else
+	(void)lazy; (void)eager; (void)name;
+#endif
+}
+
+// ADD / ADC, res is the 16bit sum including carry
+inline void CPU::set_flags_add(uint8_t a, uint8_t b, uint16_t res)
+{
+#if GB_LAZY_FLAGS
+	zres = res & 0xFF;
+	nh_op = NH_ADD;
+	nh_a = a;
+	nh_b = b;
+	nh_res = res & 0xFF;
+#endif
+#if GB_EAGER_FLAGS
+	FZ = ((res & 0xFF) == 0x00);
+	FN = 0;
+	FH = (a ^ b ^ res) & 0x10 ? 1 : 0;
+#endif
+	FC = (res & 0xFF00) ? 1 : 0;
+}
+
+// SUB / SBC / CP, res is the 16bit difference including borrow
+inline void CPU::set_flags_sub(uint8_t a, uint8_t b, uint16_t res)
+{
+#if GB_LAZY_FLAGS
+	zres = res & 0xFF;
+	nh_op = NH_SUB;
+	nh_a = a;
+	nh_b = b;
+	nh_res = res & 0xFF;
+#endif
+#if GB_EAGER_FLAGS
+	FZ = ((res & 0xFF) == 0x00);
+	FN = 1;
+	FH = (a ^ b ^ res) & 0x10 ? 1 : 0;
+#endif
+	FC = (res & 0xFF00) ? 1 : 0;
+}
+
+// INC r, C is not affected
+inline void CPU::set_flags_inc(uint8_t res)
+{
+#if GB_LAZY_FLAGS
+	zres = res;
+	nh_op = NH_INC;
+	nh_res = res;
+#endif
+#if GB_EAGER_FLAGS
+	FZ = (res == 0x00);
+	FN = 0;
+	FH = ((res & 0x0F) == 0x00);
+#endif
+}
+
+// DEC r, C is not affected
+inline void CPU::set_flags_dec(uint8_t res)
+{
+#if GB_LAZY_FLAGS
+	zres = res;
+	nh_op = NH_DEC;
+	nh_res = res;
+#endif
+#if GB_EAGER_FLAGS
+	FZ = (res == 0x00);
+	FN = 1;
+	FH = ((res & 0x0F) == 0x0F);
+#endif
+}
+
+// AND / XOR / OR
+inline void CPU::set_flags_logic(uint8_t res, uint8_t h)
+{
+#if GB_LAZY_FLAGS
+	zres = res;
+	nh_op = NH_CONST;
+	nh_a = 0;
+	nh_b = h;
+#endif
+#if GB_EAGER_FLAGS
+	FZ = (res == 0x00);
+	FN = 0;
+	FH = h;
+#endif
+	FC = 0;
+}
+
+inline void CPU::set_flags(uint8_t z, uint8_t n, uint8_t h, uint8_t c)
+{
+	set_flag_z(z);
+	set_flags_nh(n, h);
+	FC = c;
+}
+
+inline void CPU::set_flag_z(uint8_t z)
+{
+#if GB_LAZY_FLAGS
+	zres = !z;
+#endif
+#if GB_EAGER_FLAGS
+	FZ = z;
+#endif
+}
+
+inline void CPU::set_flags_nh(uint8_t n, uint8_t h)
+{
+#if GB_LAZY_FLAGS
+	nh_op = NH_CONST;
+	nh_a = n;
+	nh_b = h;
+#endif
+#if GB_EAGER_FLAGS
+	FN = n;
+	FH = h;
+#endif
+}
+
+// operand of a CB opcode, selected at compile time from its low 3 bits
+template<uint8_t R> inline uint8_t CPU::cb_load()
+{
+	if constexpr (R == 0) return RBC.b8[HI];
+	else if constexpr (R == 1) return RBC.b8[LO];
+	else if constexpr (R == 2) return RDE.b8[HI];
+	else if constexpr (R == 3) return RDE.b8[LO];
+	else if constexpr (R == 4) return RHL.b8[HI];
+	else if constexpr (R == 5) return RHL.b8[LO];
+	else if constexpr (R == 6) return memory->read(RHL.b16);
+	else return RA;
+}
+
+template<uint8_t R> inline void CPU::cb_store(uint8_t val)
+{
+	if constexpr (R == 0) RBC.b8[HI] = val;
+	else if constexpr (R == 1) RBC.b8[LO] = val;
+	else if constexpr (R == 2) RDE.b8[HI] = val;
+	else if constexpr (R == 3) RDE.b8[LO] = val;
+	else if constexpr (R == 4) RHL.b8[HI] = val;
+	else if constexpr (R == 5) RHL.b8[LO] = val;
+	else if constexpr (R == 6) memory->write(RHL.b16, val);
+	else RA = val;
+}
+
+// CB prefixed opcode, specialized over (operation, bit, register)
+template<uint8_t OP> void CPU::cb_op()
+{
+	constexpr uint8_t R = OP & 0x7;
+	constexpr uint8_t B = (OP >> 3) & 0x7;
+	uint8_t val = cb_load<R>();
+	uint8_t N = val;
+
+	if constexpr ((OP >> 6) == 0x1) { // BIT B, R
+		set_flag_z(!((val >> B) & 0x1));
+		set_flags_nh(0, 1);
+		return;
+	}
+	else if constexpr ((OP >> 6) == 0x2) { // RES B, R
+		val &= ~(0x1 << B);
+	}
+	else if constexpr ((OP >> 6) == 0x3) { // SET B, R
+		val |= (0x1 << B);
+	}
+	else if constexpr (B == 0) { // RLC R
+		val = (val << 1) | (N >> 7);
+		FC = (N >> 7);
+	}
+	else if constexpr (B == 1) { // RRC R
+		val = (val >> 1) | (N << 7);
+		FC = (N & 0x01);
+	}
+	else if constexpr (B == 2) { // RL R
+		val = (val << 1) | flag_c();
+		FC = (N >> 7);
+	}
+	else if constexpr (B == 3) { // RR R
+		val = (val >> 1) | (flag_c() << 7);
+		FC = (N & 0x01);
+	}
+	else if constexpr (B == 4) { // SLA R
+		val = val << 1;
+		FC = (N >> 7);
+	}
+	else if constexpr (B == 5) { // SRA R
+		val = (val >> 1) | (val & 0x80);
+		FC = (N & 0x01);
+	}
+	else if constexpr (B == 6) { // SWAP R
+		val = (val >> 4) | (val << 4);
+		FC = 0;
+	}
+	else { // SRL R
+		val = val >> 1;
+		FC = (N & 0x01);
+	}
+
+	if constexpr ((OP >> 6) == 0x0) {
+		set_flag_z(val == 0x00);
+		set_flags_nh(0, 0);
+	}
+	cb_store<R>(val);
+}
+
+#define GB_CB_POINTER(n) &CPU::cb_op<0x##n>,
+const CPU::OP_HANDLER CPU::CB_TABLE[0x100] = {
+	GB_FOR_EACH_OPCODE(GB_CB_POINTER)
+};
+#undef GB_CB_POINTER
+
+// bytes fetched by each handler, including the opcode
+static const uint8_t OP_LENGTH[0x100] = {
+	//   0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
+	1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,    // 0x00
+	1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,    // 0x10
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,    // 0x20
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,    // 0x30
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,    // 0x40
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,    // 0x50
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,    // 0x60
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,    // 0x70
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,    // 0x80
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,    // 0x90
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,    // 0xA0
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,    // 0xB0
+	1, 1, 3, 3, 1, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,    // 0xC0
+	1, 1, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,    // 0xD0
+	2, 1, 1, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,    // 0xE0
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,    // 0xF0
+};
+
+inline uint8_t CPU::fetch8()
+{
+#if GB_BLOCK_CACHE
+	// operands of a decoded block, PC already points past the instruction
+	if (imm) return *imm++;
+#endif
+	return memory->read(PC++);
+}
+
+inline uint16_t CPU::fetch16()
+{
+#if GB_BLOCK_CACHE
+	if (imm) {
+		uint16_t NN = imm[0] | imm[1] << 8;
+		imm += 2;
+		return NN;
+	}
+#endif
+	uint16_t NN = memory->read16(PC);
+	PC += 2;
+	return NN;
+}
+
+void CPU::shift_operation_CB() {
+	uint8_t op = fetch8();
+#if GB_PROFILE
+	if (profiler) profiler->count_cb(op, OP_CYCLES[0xCB]);
+#endif
+	(this->*CB_TABLE[op])();
+}
+
+void CPU::set_memmap(Memory *mem) {
+	memory = mem;
+}
+
+void CPU::set_profiler(Profiler* prof) {
+	profiler = prof;
+}
+
+void CPU::set_gpu(GPU* g) {
+	gpu = g;
+}
+
+void CPU::set_scheduler(Scheduler* sched) {
+	scheduler = sched;
+	scheduler->set_callback(EVENTS::LCD_LINE, [this](uint64_t at) { lcd_line_event(at); });
+	scheduler->schedule(EVENTS::LCD_LINE, scheduler->now + LCD_LINE_CYCLES);
+}
+
+// handler for opcodes without implementation
+template<uint8_t OP> void CPU::op()
+{
+	GB_LOG(CPU, ERR, "Operation not inplemented : " << std::hex << (int)OP);
+	PC--;
+	dump_reg();
+	error = true;
+	run_end = 0;
+}
+
+#define GB_OPCODE(n) template<> inline void CPU::op<n>()
+
+GB_OPCODE(0x00) //nop
+{
+}
+
+GB_OPCODE(0x01)
+{
+	RBC.b8[LO] = fetch8();
+	RBC.b8[HI] = fetch8();
+}
+
+GB_OPCODE(0x02)
+{
+	memory->write(RBC.b16, RA);
+}
+
+GB_OPCODE(0x03)
+{
+	uint16_t NN;
+	NN = RBC.b16 + 1;
+	RBC.b8[HI] = NN >> 8;
+	RBC.b8[LO] = NN & 0xFF;
+}
+
+GB_OPCODE(0x04)
+{
+	RBC.b8[HI]++;
+	set_flags_inc(RBC.b8[HI]);
+}
+
+GB_OPCODE(0x05)
+{
+	RBC.b8[HI]--;
+	set_flags_dec(RBC.b8[HI]);
+}
+
+GB_OPCODE(0x06)
+{
+	RBC.b8[HI] = fetch8(); //B
+}
+
+GB_OPCODE(0x07) // RLCA
+{
+	RA = (RA << 1) | (RA >> 7);
+	set_flags(0, 0, 0, RA & 0x01);
+}
+
+GB_OPCODE(0x08)
+{
+	RBC.b8[LO] = fetch8();
+}
+
+GB_OPCODE(0x09)
+{
+	uint32_t NNNN;
+	NNNN = RHL.b16 + RBC.b16;
+	set_flags_nh(0, (NNNN ^ RHL.b16 ^ RBC.b16) & 0x1000 ? 1 : 0);
+	FC = (NNNN & 0xFFFF0000) ? 1 : 0;
+	RHL.b8[HI] = (NNNN & 0x0000FF00) >> 8;
+	RHL.b8[LO] = (NNNN & 0x000000FF);
+}
+
+GB_OPCODE(0x0A)
+{
+	RA = memory->read(RBC.b16);
+}
+
+GB_OPCODE(0x0B)
+{
+	uint16_t NN;
+	NN = RBC.b16 - 1;
+	RBC.b8[HI] = NN >> 8;
+	RBC.b8[LO] = NN & 0xFF;
+}
+
+GB_OPCODE(0x0C)
+{
+	RBC.b8[LO]++;
+	set_flags_inc(RBC.b8[LO]);
+}
+
+GB_OPCODE(0x0D)
+{
+	RBC.b8[LO]--;
+	set_flags_dec(RBC.b8[LO]);
+}
+
+GB_OPCODE(0x0E)
+{
+	RBC.b8[LO] = fetch8(); //B
+}
+
+GB_OPCODE(0x0F) // RRCA
+{
+	set_flags(0, 0, 0, RA & 0x01);
+	RA = (RA >> 1) | (RA << 7);
+}
+
+GB_OPCODE(0x10)
+{
+	GB_LOG(CPU, TRACE, "STOP");
+	HALT = 1;
+	wait_for_interrupt();
+}
+
+GB_OPCODE(0x11)
+{
+	RDE.b8[LO] = fetch8(); //B
+	RDE.b8[HI] = fetch8(); //B
+}
+
+GB_OPCODE(0x12)
+{
+	memory->write(RDE.b16, RA);
+}
+
+GB_OPCODE(0x13)
+{
+	uint16_t NN;
+	NN = RDE.b16 + 1;
+	RDE.b8[HI] = NN >> 8;
+	RDE.b8[LO] = NN & 0xFF;
+}
+
+GB_OPCODE(0x14)
+{
+	RDE.b8[HI]++;
+	set_flags_inc(RDE.b8[HI]);
+}
+
+GB_OPCODE(0x15)
+{
+	RDE.b8[HI]--;
+	set_flags_dec(RDE.b8[HI]);
+}
+
+GB_OPCODE(0x16)
+{
+	RDE.b8[HI] = fetch8();
+}
+
+GB_OPCODE(0x17)
+{
+	uint8_t N;
+	N = RA;
+	RA = RA << 1 | flag_c();
+	set_flags(0, 0, 0, (N >> 7) & 0x01);
+}
+
+GB_OPCODE(0x18)
+{
+	int8_t SN;
+	SN = (int8_t)fetch8();
+	PC += SN;
+}
+
+GB_OPCODE(0x19)
+{
+	uint32_t NNNN;
+	NNNN = RHL.b16 + RDE.b16;
+	set_flags_nh(0, (NNNN ^ RHL.b16 ^ RDE.b16) & 0x1000 ? 1 : 0);
+	FC = (NNNN & 0xFFFF0000) ? 1 : 0;
+	RHL.b8[HI] = (NNNN & 0x0000FF00) >> 8;
+	RHL.b8[LO] = (NNNN & 0x000000FF);
+}
+
+GB_OPCODE(0x1A)
+{
+	RA = memory->read(RDE.b16);
+}
+
+GB_OPCODE(0x1B)
+{
+	uint16_t NN;
+	NN = RDE.b16 - 1;
+	RDE.b8[HI] = NN >> 8;
+	RDE.b8[LO] = NN & 0xFF;
+}
+
+GB_OPCODE(0x1C)
+{
+	RDE.b8[LO]++;
+	set_flags_inc(RDE.b8[LO]);
+}
+
+GB_OPCODE(0x1D)
+{
+	RDE.b8[LO]--;
+	set_flags_dec(RDE.b8[LO]);
+}
+
+GB_OPCODE(0x1E)
+{
+	RDE.b8[LO] = fetch8();
+}
+
+GB_OPCODE(0x1F)
+{
+	uint8_t N;
+	N = RA;
+	RA = RA >> 1 | (flag_c() << 7);
+	set_flags(0, 0, 0, N & 0x1);
+}
+
+GB_OPCODE(0x20)
+{
+	int8_t SN;
+	SN = (int8_t)fetch8();
+	if (!flag_z()) PC += SN;
+}
+
+GB_OPCODE(0x21)
+{
+	RHL.b8[LO] = fetch8();
+	RHL.b8[HI] = fetch8();
+}
+
+GB_OPCODE(0x22)
+{
+	uint16_t NN;
+	memory->write(RHL.b16 ,RA);
+	NN = RHL.b16 + 1;
+	RHL.b8[HI] = NN >> 8;
+	RHL.b8[LO] = NN & 0xFF;
+}
+
+GB_OPCODE(0x23)
+{
+	uint16_t NN;
+	NN = RHL.b16 + 1;
+	RHL.b8[HI] = NN >> 8;
+	RHL.b8[LO] = NN & 0xFF;
+}
+
+GB_OPCODE(0x24)
+{
+	RHL.b8[HI]++;
+	set_flags_inc(RHL.b8[HI]);
+}
+
+GB_OPCODE(0x25)
+{
+	RHL.b8[HI]--;
+	set_flags_dec(RHL.b8[HI]);
+}
+
+GB_OPCODE(0x26)
+{
+	RHL.b8[HI] = fetch8();
+}
+
+GB_OPCODE(0x27)
+{
+	uint8_t D1, D2;
+	D1 = RA >> 4;
+	D2 = RA & 0x0F;
+	if (flag_n())
+	{
+		if (flag_h()) D2 -= 6;
+		if (flag_c()) D1 -= 6;
+		if (D2 > 9) D2 -= 6;
+		if (D1 > 9)
+		{
+			D1 -= 6;
+			FC = 1;
+		}
+	}
+}
+
+GB_OPCODE(0x28)
+{
+	int8_t SN;
+	SN = (int8_t)fetch8();
+	if (flag_z()) PC += SN;
+}
+
+GB_OPCODE(0x29)
+{
+	uint32_t NNNN;
+	NNNN = RHL.b16 + RHL.b16;
+	set_flags_nh(0, (NNNN & 0x1000) ? 1 : 0);
+	FC = (NNNN & 0xFFFF0000) ? 1 : 0;
+	RHL.b8[HI] = (NNNN & 0x0000FF00) >> 8;
+	RHL.b8[LO] = (NNNN & 0x000000FF);
+}
+
+GB_OPCODE(0x2A)
+{
+	uint16_t NN;
+	RA = memory->read(RHL.b16);
+	NN = RHL.b16 + 1;
+	RHL.b8[HI] = NN >> 8;
+	RHL.b8[LO] = NN & 0xFF;
+}
+
+GB_OPCODE(0x2B)
+{
+	uint16_t NN;
+	NN = RHL.b16 - 1;
+	RHL.b8[HI] = NN >> 8;
+	RHL.b8[LO] = NN & 0xFF;
+}
+
+GB_OPCODE(0x2C)
+{
+	RHL.b8[LO]++;
+	set_flags_inc(RHL.b8[LO]);
+}
+
+GB_OPCODE(0x2D)
+{
+	RHL.b8[LO]--;
+	set_flags_dec(RHL.b8[LO]);
+}
+
+GB_OPCODE(0x2E)
+{
+	RHL.b8[LO] = fetch8();
+}
+
+GB_OPCODE(0x2F)
+{
+	RA = RA ^ 0xFF;
+	set_flags_nh(1, 1);
+}
+
+GB_OPCODE(0x30) // JP NC, imm
+{
+	int8_t SN;
+	SN = (int8_t)fetch8();
+	if (!flag_c()) PC += SN;
+}
+
+GB_OPCODE(0x31)
+{
+	SP = fetch16();
+}
+
+GB_OPCODE(0x32)
+{
+	uint16_t NN;
+	memory->write(RHL.b16,  RA);
+	NN = RHL.b16 - 1;
+	RHL.b8[HI] = NN >> 8;
+	RHL.b8[LO] = NN & 0xFF;
+}
+
+GB_OPCODE(0x34)
+{
+	uint8_t N;
+	N = memory->read(RHL.b16) + 1;
+	set_flags_inc(N);
+	memory->write(RHL.b16, N);
+}
+
+GB_OPCODE(0x35)
+{
+	uint8_t N;
+	N = memory->read(RHL.b16) - 1;
+	set_flags_dec(N);
+	memory->write(RHL.b16, N);
+}
+
+GB_OPCODE(0x36)
+{
+	memory->write(RHL.b16, fetch8());
+}
+
+GB_OPCODE(0x37)
+{
+	set_flags_nh(0, 0);
+	FC = 1;
+}
+
+GB_OPCODE(0x38)
+{
+	int8_t SN;
+	SN = (int8_t)fetch8();
+	if (flag_c())
+	{
+		PC += SN;
+	}
+}
+
+GB_OPCODE(0x39) // ADD HL, SP
+{
+	uint32_t NNNN;
+	NNNN = RHL.b16 + SP;
+	set_flags_nh(0, (NNNN ^ RHL.b16 ^ SP) & 0x1000 ? 1 : 0);
+	FC = (NNNN & 0xFFFF0000) ? 1 : 0;
+	RHL.b8[HI] = (NNNN & 0x0000FF00) >> 8;
+	RHL.b8[LO] = (NNNN & 0x000000FF);
+}
+
+GB_OPCODE(0x3A)
+{
+	uint16_t NN;
+	RA = memory->read(RHL.b16);
+	NN = RHL.b16 - 1;
+	RHL.b8[HI] = NN >> 8;
+	RHL.b8[LO] = NN & 0xFF;
+}
+
+GB_OPCODE(0x3B) // DEC SP
+{
+	SP--;
+}
+
+GB_OPCODE(0x3C)
+{
+	RA++;
+	set_flags_inc(RA);
+}
+
+GB_OPCODE(0x3D)
+{
+	RA--;
+	set_flags_dec(RA);
+}
+
+GB_OPCODE(0x3E)
+{
+	RA = fetch8();
+}
+
+GB_OPCODE(0x3F)
+{
+	set_flags_nh(0, 0);
+	FC = FC ^ 0x1;
+}
+
+GB_OPCODE(0x40) //do nothing
+{
+}
+
+GB_OPCODE(0x41) // LD B, C
+{
+	RBC.b8[HI] = RBC.b8[LO];
+}
+
+GB_OPCODE(0x42)
+{
+	RBC.b8[HI] = RDE.b8[HI];
+}
+
+GB_OPCODE(0x43) // LD B, E
+{
+	RBC.b8[HI] = RDE.b8[LO];
+}
+
+GB_OPCODE(0x44)
+{
+	RBC.b8[HI] = RHL.b8[HI];
+}
+
+GB_OPCODE(0x45) // LD B, L
+{
+	RBC.b8[HI] = RHL.b8[LO];
+}
+
+GB_OPCODE(0x46)
+{
+	RBC.b8[HI] = memory->read(RHL.b16);
+}
+
+GB_OPCODE(0x47)
+{
+	RBC.b8[HI] = RA;
+}
+
+GB_OPCODE(0x48) // LD C, B
+{
+	RBC.b8[LO] = RBC.b8[HI];
+}
+
+GB_OPCODE(0x49) // LD C, C
+{
+}
+
+GB_OPCODE(0x4A) // LD C, D
+{
+	RBC.b8[LO] = RDE.b8[HI];
+}
+
+GB_OPCODE(0x4B) // LD C, E
+{
+	RBC.b8[LO] = RDE.b8[LO];
+}
+
+GB_OPCODE(0x4C) // LD C, H
+{
+	RBC.b8[LO] = RHL.b8[HI];
+}
+
+GB_OPCODE(0x4D) // LD C, L
+{
+	RBC.b8[LO] = RHL.b8[LO];
+}
+
+GB_OPCODE(0x4E)
+{
+	RBC.b8[LO] = memory->read(RHL.b16);
+}
+
+GB_OPCODE(0x4F)
+{
+	RBC.b8[LO] = RA;
+}
+
+GB_OPCODE(0x50)
+{
+	RDE.b8[HI] = RBC.b8[HI];
+}
+
+GB_OPCODE(0x51)
+{
+	RDE.b8[HI] = RBC.b8[LO];
+}
+
+GB_OPCODE(0x52) // do nothing
+{
+}
+
+GB_OPCODE(0x53)
+{
+	RDE.b8[HI] = RDE.b8[LO];
+}
+
+GB_OPCODE(0x54)
+{
+	RDE.b8[HI] = RHL.b8[HI];
+}
+
+GB_OPCODE(0x55)
+{
+	RDE.b8[HI] = RHL.b8[LO];
+}
+
+GB_OPCODE(0x56)
+{
+	RDE.b8[HI] = memory->read(RHL.b16);
+}
+
+GB_OPCODE(0x57)
+{
+	RDE.b8[HI] = RA;
+}
+
+GB_OPCODE(0x58)
+{
+	RDE.b8[LO] = RBC.b8[HI];
+}
+
+GB_OPCODE(0x59)
+{
+	RDE.b8[LO] = RDE.b8[HI];
+}
+
+GB_OPCODE(0x5B) //do nothing
+{
+}
+
+GB_OPCODE(0x5C)
+{
+	RDE.b8[LO] = RHL.b8[HI];
+}
+
+GB_OPCODE(0x5D)
+{
+	RDE.b8[LO] = RHL.b8[LO];
+}
+
+GB_OPCODE(0x5E)
+{
+	RDE.b8[LO] = memory->read(RHL.b16);
+}
+
+GB_OPCODE(0x5F)
+{
+	RDE.b8[LO] = RA;
+}
+
+GB_OPCODE(0x60)
+{
+	RHL.b8[HI] = RBC.b8[HI];
+}
+
+GB_OPCODE(0x61)
+{
+	RHL.b8[HI] = RBC.b8[LO];
+}
+
+GB_OPCODE(0x62)
+{
+	RHL.b8[HI] = RDE.b8[HI];
+}
+
+GB_OPCODE(0x66)
+{
+	RHL.b8[HI] = memory->read(RHL.b16);
+}
+
+GB_OPCODE(0x67)
+{
+	RHL.b8[HI] = RA;
+}
+
+GB_OPCODE(0x68) // LD L, B
+{
+	RHL.b8[LO] = RBC.b8[HI];
+}
+
+GB_OPCODE(0x69)
+{
+	RHL.b8[LO] = RBC.b8[LO];
+}
+
+GB_OPCODE(0x6A) // LD L, D
+{
+	RHL.b8[LO] = RDE.b8[HI];
+}
+
+GB_OPCODE(0x6B)
+{
+	RHL.b8[LO] = RDE.b8[LO];
+}
+
+GB_OPCODE(0x6C) // LD L, H
+{
+	RHL.b8[LO] = RHL.b8[HI];
+}
+
+GB_OPCODE(0x6D) // LD L, L
+{
+}
+
+GB_OPCODE(0x6E) // LD L, (HL)
+{
+	RHL.b8[LO] = memory->read(RHL.b16);
+}
+
+GB_OPCODE(0x6F)
+{
+	RHL.b8[LO] = RA;
+}
+
+GB_OPCODE(0x70)
+{
+	memory->write(RHL.b16, RBC.b8[HI]);
+}
+
+GB_OPCODE(0x71)
+{
+	memory->write(RHL.b16, RBC.b8[LO]);
+}
+
+GB_OPCODE(0x72)
+{
+	memory->write(RHL.b16, RDE.b8[HI]);
+}
+
+GB_OPCODE(0x73)
+{
+	memory->write(RHL.b16, RDE.b8[LO]);
+}
+
+GB_OPCODE(0x74)
+{
+	memory->write(RHL.b16, RHL.b8[HI]);
+}
+
+GB_OPCODE(0x75)
+{
+	memory->write(RHL.b16, RHL.b8[LO]);
+}
+
+GB_OPCODE(0x76)
+{
+	HALT = 1;
+	wait_for_interrupt();
+}
+
+GB_OPCODE(0x77)
+{
+	memory->write(RHL.b16,  RA);
+}
+
+GB_OPCODE(0x78)
+{
+	RA = RBC.b8[HI];
+}
+
+GB_OPCODE(0x79)
+{
+	RA = RBC.b8[LO];
+}
+
+GB_OPCODE(0x7A)
+{
+	RA = RDE.b8[HI];
+}
+
+GB_OPCODE(0x7B)
+{
+	RA = RDE.b8[LO];
+}
+
+GB_OPCODE(0x7C)
+{
+	RA = RHL.b8[HI];
+}
+
+GB_OPCODE(0x7D)
+{
+	RA = RHL.b8[LO];
+}
+
+GB_OPCODE(0x7E)
+{
+	RA = memory->read(RHL.b16);
+}
+
+GB_OPCODE(0x7F)
+{
+}
+
+GB_OPCODE(0x80)
+{
+	uint16_t NN;
+	NN = RA + RBC.b8[HI];
+	set_flags_add(RA, RBC.b8[HI], NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x81) // ADD A, C
+{
+	uint16_t NN;
+	NN = RA + RBC.b8[LO];
+	set_flags_add(RA, RBC.b8[LO], NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x82)
+{
+	uint16_t NN;
+	NN = RA + RDE.b8[HI];
+	set_flags_add(RA, RDE.b8[HI], NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x83) // ADD A, E
+{
+	uint16_t NN;
+	NN = RA + RDE.b8[LO];
+	set_flags_add(RA, RDE.b8[LO], NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x85)
+{
+	uint16_t NN;
+	NN = RA + RHL.b8[LO];
+	set_flags_add(RA, RHL.b8[LO], NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x86)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = memory->read(RHL.b16);
+	NN = RA + N;
+	set_flags_add(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x87)
+{
+	uint16_t NN;
+	NN = RA + RA;
+	set_flags_add(RA, RA, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x88) // ADC A, B
+{
+	uint16_t NN;
+	uint8_t N;
+	N = RBC.b8[HI];
+	NN = RA + N + flag_c();
+	set_flags_add(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x89)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = RBC.b8[LO];
+	NN = RA + N + flag_c();
+	set_flags_add(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x8A)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = RDE.b8[HI];
+	NN = RA + N + flag_c();
+	set_flags_add(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x8C)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = RHL.b8[HI];
+	NN = RA + N + flag_c();
+	set_flags_add(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x8D)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = RHL.b8[LO];
+	NN = RA + N + flag_c();
+	set_flags_add(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x8E) // ADC A, (HL)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = memory->read(RHL.b16);
+	NN = RA + N + flag_c();
+	set_flags_add(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x8F) // ADC A, A
+{
+	uint16_t NN;
+	uint8_t N;
+	N = RA;
+	NN = RA + N + flag_c();
+	set_flags_add(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x90)
+{
+	uint16_t NN;
+	NN = RA - RBC.b8[HI];
+	set_flags_sub(RA, RBC.b8[HI], NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x91) // SUB C
+{
+	uint16_t NN;
+	NN = RA - RBC.b8[LO];
+	set_flags_sub(RA, RBC.b8[LO], NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x92) // SUB D
+{
+	uint16_t NN;
+	NN = RA - RDE.b8[HI];
+	set_flags_sub(RA, RDE.b8[HI], NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x93) // SUB E
+{
+	uint16_t NN;
+	NN = RA - RDE.b8[LO];
+	set_flags_sub(RA, RDE.b8[LO], NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x94) // SUB H
+{
+	uint16_t NN;
+	NN = RA - RHL.b8[HI];
+	set_flags_sub(RA, RHL.b8[HI], NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x95) // SUB L
+{
+	uint16_t NN;
+	NN = RA - RHL.b8[LO];
+	set_flags_sub(RA, RHL.b8[LO], NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x96)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = memory->read(RHL.b16);
+	NN = RA - N;
+	set_flags_sub(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x97)
+{
+	RA = 0x00;
+	set_flags(1, 1, 0, 0);
+}
+
+GB_OPCODE(0x98)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = RBC.b8[HI];
+	NN = RA - N - flag_c();
+	set_flags_sub(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x99)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = RBC.b8[LO];
+	NN = RA - N - flag_c();
+	set_flags_sub(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x9A)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = RDE.b8[HI];
+	NN = RA - N - flag_c();
+	set_flags_sub(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x9B)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = RDE.b8[LO];
+	NN = RA - N - flag_c();
+	set_flags_sub(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x9C)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = RHL.b8[HI];
+	NN = RA - N - flag_c();
+	set_flags_sub(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x9D)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = RHL.b8[LO];
+	NN = RA - N - flag_c();
+	set_flags_sub(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x9E)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = memory->read(RHL.b16);
+	NN = RA - N - flag_c();
+	set_flags_sub(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0x9F)
+{
+	uint8_t N;
+	N = flag_c();
+	RA = N ? 0xFF : 0x00;
+	set_flags(N ? 0x00 : 0x01, 1, N, N);
+}
+
+GB_OPCODE(0xA0)
+{
+	RA = RA & RBC.b8[HI];
+	set_flags_logic(RA, 1);
+}
+
+GB_OPCODE(0xA1)
+{
+	RA = RA & RBC.b8[LO];
+	set_flags_logic(RA, 1);
+}
+
+GB_OPCODE(0xA2)
+{
+	RA = RA & RDE.b8[HI];
+	set_flags_logic(RA, 1);
+}
+
+GB_OPCODE(0xA3)
+{
+	RA = RA & RDE.b8[LO];
+	set_flags_logic(RA, 1);
+}
+
+GB_OPCODE(0xA4)
+{
+	RA = RA & RHL.b8[HI];
+	set_flags_logic(RA, 1);
+}
+
+GB_OPCODE(0xA5)
+{
+	RA = RA & RHL.b8[LO];
+	set_flags_logic(RA, 1);
+}
+
+GB_OPCODE(0xA6)
+{
+	RA = RA & memory->read(RHL.b16);
+	set_flags_logic(RA, 1);
+}
+
+GB_OPCODE(0xA7)
+{
+	set_flags_logic(RA, 1);
+}
+
+GB_OPCODE(0xA8)
+{
+	RA = RA ^ RBC.b8[HI];
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xA9)
+{
+	RA = RA ^ RBC.b8[LO];
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xAA) // XOR D
+{
+	RA = RA ^ RDE.b8[HI];
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xAB) // XOR E
+{
+	RA = RA ^ RDE.b8[LO];
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xAC) // XOR H
+{
+	RA = RA ^ RHL.b8[HI];
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xAD) // XOR L
+{
+	RA = RA ^ RHL.b8[LO];
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xAE)
+{
+	RA = RA ^ memory->read(RHL.b16);
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xAF)
+{
+	RA = 0x00;
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xB0)
+{
+	RA = RA | RBC.b8[HI];
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xB1)
+{
+	RA = RA | RBC.b8[LO];
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xB2)
+{
+	RA = RA | RDE.b8[HI];
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xB3)
+{
+	RA = RA | RDE.b8[LO];
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xB4)
+{
+	RA = RA | RHL.b8[HI];
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xB5)
+{
+	RA = RA | RHL.b8[LO];
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xB6)
+{
+	RA = RA | memory->read(RHL.b16);
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xB7)
+{
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xB8)
+{
+	uint16_t NN;
+	NN = RA - RBC.b8[HI];
+	set_flags_sub(RA, RBC.b8[HI], NN);
+}
+
+GB_OPCODE(0xB9)
+{
+	uint16_t NN;
+	NN = RA - RBC.b8[LO];
+	set_flags_sub(RA, RBC.b8[LO], NN);
+}
+
+GB_OPCODE(0xBA)
+{
+	uint16_t NN;
+	NN = RA - RDE.b8[HI];
+	set_flags_sub(RA, RDE.b8[HI], NN);
+}
+
+GB_OPCODE(0xBB)
+{
+	uint16_t NN;
+	NN = RA - RDE.b8[LO];
+	set_flags_sub(RA, RDE.b8[LO], NN);
+}
+
+GB_OPCODE(0xBC)
+{
+	uint16_t NN;
+	NN = RA - RHL.b8[HI];
+	set_flags_sub(RA, RHL.b8[HI], NN);
+}
+
+GB_OPCODE(0xBD)
+{
+	uint16_t NN;
+	NN = RA - RHL.b8[LO];
+	set_flags_sub(RA, RHL.b8[LO], NN);
+}
+
+GB_OPCODE(0xBE)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = memory->read(RHL.b16);
+	NN = RA - N;
+	set_flags_sub(RA, N, NN);
+}
+
+GB_OPCODE(0xBF)
+{
+	set_flags(1, 1, 0, 0);
+}
+
+GB_OPCODE(0xC0)
+{
+	uint16_t NN;
+	if (!flag_z())
+	{
+		NN = memory->read(SP++);
+		NN |= memory->read(SP++) << 8;
+		PC = NN;
+	}
+}
+
+GB_OPCODE(0xC1)
+{
+	RBC.b8[LO] = memory->read(SP++);
+	RBC.b8[HI] = memory->read(SP++);
+}
+
+GB_OPCODE(0xC2)
+{
+	uint16_t NN;
+	NN = fetch16();
+	if (!flag_z()) PC = NN;
+}
+
+GB_OPCODE(0xC3)
+{
+	uint16_t NN;
+	NN = fetch16();
+	PC = NN;
+}
+
+GB_OPCODE(0xC5)
+{
+	memory->write(--SP,RBC.b8[HI]);
+	memory->write(--SP,RBC.b8[LO]);
+}
+
+GB_OPCODE(0xC6) // ADD A, imm
+{
+	uint16_t NN;
+	uint8_t N;
+	N = fetch8();
+	NN = RA + N;
+	set_flags_add(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0xC7)
+{
+	memory->write(--SP, PC >> 8);
+	memory->write(--SP, PC & 0xFF);
+	PC = 0x0000;
+}
+
+GB_OPCODE(0xC8)
+{
+	uint16_t NN;
+	if (flag_z())
+	{
+		NN = memory->read(SP++);
+		NN |= memory->read(SP++) << 8;
+		PC = NN;
+	}
+}
+
+GB_OPCODE(0xC9)
+{
+	uint16_t NN;
+	NN = memory->read(SP++);
+	NN |= memory->read(SP++) << 8;
+	PC = NN;
+}
+
+GB_OPCODE(0xCA)
+{
+	uint16_t NN;
+	NN = fetch16();
+	if (flag_z()) PC = NN;
+}
+
+GB_OPCODE(0xCB)
+{
+	shift_operation_CB();
+}
+
+GB_OPCODE(0xCC) // CALL Z, imm
+{
+	uint16_t NN;
+	NN = fetch16();
+	if (flag_z())
+	{
+		memory->write(--SP, PC >> 8);
+		memory->write(--SP, PC & 0xFF);
+		PC = NN;
+	}
+}
+
+GB_OPCODE(0xCD)
+{
+	uint16_t NN;
+	NN = fetch16();
+	memory->write(--SP , PC >> 8);
+	memory->write(--SP , PC & 0xFF);
+	PC = NN;
+}
+
+GB_OPCODE(0xCE)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = fetch8();
+	NN = RA + N + flag_c();
+	set_flags_add(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0xCF)
+{
+	memory->write(--SP, PC >> 8);
+	memory->write(--SP, PC & 0xFF);
+	PC = 0x0008;
+}
+
+GB_OPCODE(0xD0) // RET NC
+{
+	uint16_t NN;
+	if (!flag_c())
+	{
+		NN =  memory->read(SP++);
+		NN |= memory->read(SP++) << 8;
+		PC = NN;
+	}
+}
+
+GB_OPCODE(0xD1)
+{
+	RDE.b8[LO] = memory->read(SP++);
+	RDE.b8[HI] = memory->read(SP++);
+}
+
+GB_OPCODE(0xD2)
+{
+	uint16_t NN;
+	NN = fetch16();
+	if (!flag_c()) PC = NN;
+}
+
+GB_OPCODE(0xD5)
+{
+	memory->write(--SP,RDE.b8[HI]);
+	memory->write(--SP,RDE.b8[LO]);
+}
+
+GB_OPCODE(0xD6)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = fetch8();
+	NN = RA - N;
+	set_flags_sub(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0xD7)
+{
+	memory->write(--SP, PC >> 8);
+	memory->write(--SP, PC & 0xFF);
+	PC = 0x0010;
+}
+
+GB_OPCODE(0xD8)
+{
+	uint16_t NN;
+	if (flag_c())
+	{
+		NN = memory->read(SP++);
+		NN |= memory->read(SP++) << 8;
+		PC = NN;
+	}
+}
+
+GB_OPCODE(0xD9)
+{
+	uint16_t NN;
+	NN = memory->read(SP++);
+	NN |= memory->read(SP++) << 8;
+	PC = NN;
+	IME = 1;
+}
+
+GB_OPCODE(0xDA) // JP C, imm
+{
+	uint16_t NN;
+	NN = fetch16();
+	if (flag_c())
+	{
+		PC = NN;
+	}
+}
+
+GB_OPCODE(0xDB) // illegal
+{
+}
+
+GB_OPCODE(0xDC) // CALL C, imm
+{
+	uint16_t NN;
+	NN = fetch16();
+	if (flag_c())
+	{
+		memory->write(--SP, PC >> 8);
+		memory->write(--SP, PC & 0xFF);
+		PC = NN;
+	}
+}
+
+GB_OPCODE(0xDD) // illegal
+{
+}
+
+GB_OPCODE(0xDE)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = fetch8();
+	NN = RA - N - flag_c();
+	set_flags_sub(RA, N, NN);
+	RA = NN & 0xFF;
+}
+
+GB_OPCODE(0xE0)
+{
+	memory->write((0xFF00 | fetch8()),  RA);
+}
+
+GB_OPCODE(0xE1)
+{
+	RHL.b8[LO] = memory->read(SP++);
+	RHL.b8[HI] = memory->read(SP++);
+}
+
+GB_OPCODE(0xE2)
+{
+	memory->write(0xFF00 | RBC.b8[LO], RA);
+}
+
+GB_OPCODE(0xE5)
+{
+	memory->write(--SP,RHL.b8[HI]);
+	memory->write(--SP,RHL.b8[LO]);
+}
+
+GB_OPCODE(0xE6)
+{
+	RA = RA & fetch8();
+	set_flags_logic(RA, 1);
+}
+
+GB_OPCODE(0xE9)
+{
+	PC = RHL.b16;
+}
+
+GB_OPCODE(0xEA)
+{
+	memory->write(fetch16(),  RA);
+}
+
+GB_OPCODE(0xEB) // illegal
+{
+}
+
+GB_OPCODE(0xEC) // illegal
+{
+}
+
+GB_OPCODE(0xED) // illegal
+{
+}
+
+GB_OPCODE(0xEE)
+{
+	RA = RA ^ fetch8();
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xEF)
+{
+	memory->write(--SP, PC >> 8);
+	memory->write(--SP, PC & 0xFF);
+	PC = 0x0028;
+}
+
+GB_OPCODE(0xF0)
+{
+	RA = memory->read((0xFF00 | fetch8()));
+}
+
+GB_OPCODE(0xF1)
+{
+	uint8_t N;
+	N = memory->read(SP++);
+	set_flags((N >> 7) & 1, (N >> 6) & 1, (N >> 5) & 1, (N >> 4) & 1);
+	RA = memory->read(SP++);
+}
+
+GB_OPCODE(0xF3)
+{
+	GB_LOG(CPU, TRACE, "disable IME");
+	IME = 0;
+}
+
+GB_OPCODE(0xF5)
+{
+	memory->write(--SP , RA);
+	memory->write(--SP , flag_z()<<7|flag_n()<<6|flag_h()<<5|flag_c()<<4);
+}
+
+GB_OPCODE(0xF6)
+{
+	RA = RA | fetch8();
+	set_flags_logic(RA, 0);
+}
+
+GB_OPCODE(0xF7)
+{
+	memory->write(--SP, PC >> 8);
+	memory->write(--SP, PC & 0xFF);
+	PC = 0x0030;
+}
+
+GB_OPCODE(0xF8) // LD HL, SP+/-imm
+{
+	uint16_t NN;
+	int8_t SN;
+	SN = (int8_t)fetch8();
+	NN = SP + SN;
+	if (SN >= 0)
+	{
+		set_flags(0, 0, ((SP ^ SN ^ NN) & 0x1000) ? 1 : 0, SP > NN);
+	}
+	else
+	{
+		set_flags(0, 0, ((SP ^ SN ^ NN) & 0x1000) ? 1 : 0, SP < NN);
+	}
+	RHL.b8[HI] = (NN & 0xFF00) >> 8;
+	RHL.b8[LO] = (NN & 0x00FF);
+}
+
+GB_OPCODE(0xF9)
+{
+	SP = RHL.b16;
+}
+
+GB_OPCODE(0xFA)
+{
+	RA = memory->read(fetch16());
+}
+
+GB_OPCODE(0xFB)
+{
+	IME = 1;
+}
+
+GB_OPCODE(0xFE)
+{
+	uint16_t NN;
+	uint8_t N;
+	N = fetch8();
+	NN = RA - N;
+	set_flags_sub(RA, N, NN);
+}
+
+GB_OPCODE(0xFF)
+{
+	memory->write(--SP, PC >> 8);
+	memory->write(--SP, PC & 0xFF);
+	PC = 0x0038;
+}
+
+#undef GB_OPCODE
+
+// index of the lowest set bit, x must not be 0
+static inline uint8_t lowest_set_bit(uint8_t x)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, x);
+	return static_cast<uint8_t>(index);
+#else
+	return static_cast<uint8_t>(__builtin_ctz(x));
+#endif
+}
+
+// interrupt dispatch, takes the highest priority pending interrupt.
+// only reached while IME is set and something is pending
+void CPU::service_interrupts()
+{
+	// indexed by INTERRUPTS, lowest bit has the highest priority
+	static const uint16_t vectors[] = {
+		VBLANK_INTR_ADDR, LCD_STAT_INTR_ADDR, TIMER_INTR_ADDR, SERIAL_INTR_ADDR, KEYPAD_INTR_ADDR
+	};
+	static const char* const names[] = { "V-blank", "LCD STAT", "timer", "serial", "keypad" };
+
+	const uint8_t bit = lowest_set_bit(memory->interrupt_pending);
+	HALT = 0;
+	GB_LOG(INTERRUPT, TRACE, names[bit] << " interrupt at PC " << std::hex << (int)PC);
+	IME = 0;
+	memory->write(--SP, PC >> 8);
+	memory->write(--SP, PC & 0xFF);
+	PC = vectors[bit];
+	memory->write(INTERRUPT_FLAG, memory->read(INTERRUPT_FLAG) & ~(1 << bit));
+}
+
+// LY moves to the next line
+void CPU::lcd_line_event(uint64_t at)
+{
+	if (gpu) gpu->draw_line(memory->read(LCDC_Y_CORDINATE));	//the line just finished
+	memory->write( LCDC_Y_CORDINATE , (memory->read(LCDC_Y_CORDINATE) + 1) % LCD_VERT_LINES);
+	if (memory->read(LCDC_Y_CORDINATE) == FRAME_HEIGHT) {
+		ready_for_render = true;
+		run_end = 0;
+		set_interrupt_flag(INTERRUPTS::V_BLANK);
+	}
+	scheduler->schedule(EVENTS::LCD_LINE, at + LCD_LINE_CYCLES);
+}
+
+// HALT: nothing executes until an interrupt is pending, so the clock
+// jumps from event to event instead of stepping instructions.
+// returns with HALT still set when run_end is reached first
+void CPU::wait_for_interrupt()
+{
+	while (!memory->interrupt_pending) {
+		if (scheduler->now >= run_end) return;
+		const uint64_t next = std::min(scheduler->next_event(), run_end);
+		if (next > scheduler->now) scheduler->now = next;
+		if (scheduler->now >= scheduler->next_event()) scheduler->dispatch();
+	}
+	HALT = 0;
+}
+
+// bookkeeping before an instruction: interrupts and end of boot
+inline void CPU::begin_instruction()
+{
+	if (IME && memory->interrupt_pending) service_interrupts();
+
+	if (memory->is_booting && PC == BOOTROM_SIZE) {
+		GB_LOG(SYSTEM, INFO, "finish boot seqence");
+		memory->finish_boot();
+	}
+#if GB_PROFILE
+	profile_pc = PC;
+	profile_bank = memory->get_memory_bank();
+#endif
+}
+
+// bookkeeping after an instruction: advance the clock and run due events
+inline void CPU::end_instruction(uint8_t op)
+{
+	instruction_count++;
+	scheduler->now += OP_CYCLES[op];
+#if GB_PROFILE
+	if (profiler) profiler->count(op, profile_bank, profile_pc, OP_CYCLES[op]);
+#endif
+	if (scheduler->now >= scheduler->next_event()) scheduler->dispatch();
+}
+
+#define GB_OP_POINTER(n) &CPU::op<0x##n>,
+const CPU::OP_HANDLER CPU::OP_TABLE[0x100] = {
+	GB_FOR_EACH_OPCODE(GB_OP_POINTER)
+};
+#undef GB_OP_POINTER
+
+inline void CPU::execute(uint8_t op)
+{
+#if GB_DISPATCH == GB_DISPATCH_SWITCH
+#define GB_OP_CASE(n) case 0x##n: this->op<0x##n>(); break;
+	switch (op) {
+		GB_FOR_EACH_OPCODE(GB_OP_CASE)
+	}
+#undef GB_OP_CASE
+#else
+	(this->*OP_TABLE[op])();
+#endif
+}
+
+// stop before an instruction with breakpoint. the instruction is executed on the next run
+inline bool CPU::hit_breakpoint()
+{
+	if (!breakpoint_count) return false;
+	if (!breakpoints[PC] || at_breakpoint) {
+		at_breakpoint = false;
+		return false;
+	}
+	at_breakpoint = true;
+	return true;
+}
+
+void CPU::step() 
+{
+	if (ready_for_render || error) return;
+	if (HALT) {
+		// advance to the next event only
+		run_end = scheduler->next_event();
+		wait_for_interrupt();
+		return;
+	}
+	begin_instruction();
+	uint8_t op = fetch8();
+	execute(op);
+	end_instruction(op);
+}
+
+// run instructions one by one through the selected dispatch engine
+void CPU::run_dispatch()
+{
+#if GB_DISPATCH == GB_DISPATCH_GOTO
+	static const void* const labels[0x100] = {
+#define GB_OP_LABEL(n) &&op_##n,
+		GB_FOR_EACH_OPCODE(GB_OP_LABEL)
+#undef GB_OP_LABEL
+	};
+	uint8_t op;
+
+	// every handler ends with its own copy of the dispatch jump
+#define GB_NEXT() \
+	if (scheduler->now >= run_end || hit_breakpoint()) return; \
+	begin_instruction(); \
+	op = fetch8(); \
+	goto *labels[op];
+
+	GB_NEXT();
+#define GB_OP_BODY(n) op_##n: this->op<0x##n>(); end_instruction(0x##n); GB_NEXT();
+	GB_FOR_EACH_OPCODE(GB_OP_BODY)
+#undef GB_OP_BODY
+#undef GB_NEXT
+#else
+	while (scheduler->now < run_end && !hit_breakpoint()) {
+		begin_instruction();
+		uint8_t op = fetch8();
+		execute(op);
+		end_instruction(op);
+	}
+#endif
+}
+
+// instructions after which the next PC is not known at decode time
+static bool ends_block(uint8_t op)
+{
+	switch (op) {
+	case 0x10: case 0x76:	// STOP, HALT
+	case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:	// JR
+	case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9:	// JP
+	case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:	// CALL
+	case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9:	// RET, RETI
+	case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF:	// RST
+		return true;
+	default:
+		return false;
+	}
+}
+
+// block_index regions: 0 is RAM, ROM bank n is 1 + 2n at 0x0000 and 2 + 2n at 0x4000
+static const uint32_t BLOCK_RAM_REGION = 0;
+
+// cached block starting at PC, decoded on first use. nullptr if PC is not cacheable
+CPU::Block* CPU::find_block()
+{
+	uint32_t region;
+	uint16_t offset;
+	if (PC < 0x4000) {
+		if (memory->is_booting && PC < BOOTROM_SIZE) return nullptr;
+		region = 1 + 2 * memory->get_rom_bank0();
+		offset = PC;
+	}
+	else if (PC < 0x8000) {
+		region = 2 + 2 * memory->get_memory_bank();
+		offset = PC - 0x4000;
+	}
+	else if ((PC >= 0xC000 && PC < 0xE000) || (PC >= 0xFF80 && PC < 0xFFFF)) {
+		// work RAM and high RAM
+		region = BLOCK_RAM_REGION;
+		offset = PC - 0x8000;
+	}
+	else {
+		return nullptr;
+	}
+
+	if (block_index.size() <= region) block_index.resize(region + 1);
+	auto& index = block_index[region];
+	if (index.empty()) index.resize(region == BLOCK_RAM_REGION ? 0x8000 : 0x4000, 0);
+
+	uint32_t& slot = index[offset];
+	if (!slot) {
+		blocks.emplace_back();
+		slot = static_cast<uint32_t>(blocks.size());
+		decode_block(blocks.back(), PC);
+	}
+	Block& block = blocks[slot - 1];
+	if (region == BLOCK_RAM_REGION && block.generation != memory->get_code_generation(PC)) {
+		decode_block(block, PC);
+	}
+	return &block;
+}
+
+void CPU::decode_block(Block& block, uint16_t pc)
+{
+	// a block never leaves its ROM bank or RAM chunk
+	uint32_t limit;
+	if (pc < 0x4000) limit = 0x4000;
+	else if (pc < 0x8000) limit = 0x8000;
+	else {
+		limit = ((pc >> CODE_CHUNK_SHIFT) + 1) << CODE_CHUNK_SHIFT;
+		if (limit > 0xFFFF) limit = 0xFFFF;
+		memory->mark_code(pc);
+		block.generation = memory->get_code_generation(pc);
+	}
+
+	block.pc = pc;
+	block.count = 0;
+	if (pc < 0x8000) block.generation = 0;
+	uint32_t addr = pc;
+	while (block.count < BLOCK_MAX_OPS) {
+		uint8_t op = memory->read(addr);
+		uint8_t length = OP_LENGTH[op];
+		if (addr + length > limit) break;
+
+		DecodedOp& d = block.ops[block.count++];
+		d.handler = OP_TABLE[op];
+		d.op = op;
+		d.length = length;
+		d.imm[0] = length > 1 ? memory->read(addr + 1) : 0;
+		d.imm[1] = length > 2 ? memory->read(addr + 2) : 0;
+		addr += length;
+		if (ends_block(op)) break;
+	}
+}
+
+// run a decoded block until it ends, an interrupt is taken or the code under it changes
+void CPU::run_block(const Block& block)
+{
+	const uint32_t generation = memory->code_generation;
+	uint8_t i = 0;
+	for (;;) {
+		const DecodedOp& d = block.ops[i];
+		imm = d.imm;
+		PC += d.length;
+		(this->*d.handler)();
+		end_instruction(d.op);
+
+		if (++i == block.count || scheduler->now >= run_end || memory->code_generation != generation) break;
+		if (IME && memory->interrupt_pending) break;
+	}
+	imm = nullptr;
+}
+
+void CPU::run_blocks()
+{
+	while (scheduler->now < run_end) {
+		begin_instruction();
+		Block* block = find_block();
+		if (block && block->count) {
+			run_block(*block);
+		}
+		else {
+			uint8_t op = fetch8();
+			execute(op);
+			end_instruction(op);
+		}
+	}
+}
+
+RUN_STATUS CPU::run(uint64_t cycles)
+{
+	const uint64_t end = scheduler->now + cycles;
+	run_end = (ready_for_render || error) ? 0 : end;
+
+	if (HALT) wait_for_interrupt();
+	if (!HALT) {
+#if GB_BLOCK_CACHE && !GB_PROFILE
+		if (!breakpoint_count) run_blocks();
+		else
+#endif
+		run_dispatch();
+	}
+
+	if (ready_for_render) return RUN_STATUS::FRAME_READY;
+	if (error) return RUN_STATUS::ERROR;
+	if (scheduler->now >= end) return RUN_STATUS::CYCLES_DONE;
+	return RUN_STATUS::BREAKPOINT;
+}
+
+void CPU::set_breakpoint(uint16_t address) {
+	if (!breakpoints[address]) breakpoint_count++;
+	breakpoints[address] = true;
+}
+
+void CPU::clear_breakpoint(uint16_t address) {
+	if (breakpoints[address]) breakpoint_count--;
+	breakpoints[address] = false;
+}
+
+void CPU::set_interrupt_flag(INTERRUPTS intrpt) {
+	memory->write( INTERRUPT_FLAG , memory->read(INTERRUPT_FLAG) | 1 << static_cast<uint8_t>(intrpt) );
+}
+
+void CPU::dump_reg() {
+	int op = memory->read(PC);
+	std::cout << std::hex << "PC " << (int)PC << " " <<
+		         std::hex << "OP " << (int)op << " " << 
+				 std::hex << "RA " << (int)RA << " " <<
+				 std::hex << "RB " << (int)RBC.b8[HI] << " " <<
+				 std::hex << "RC " << (int)RBC.b8[LO] << " " <<
+				 std::hex << "RD " << (int)RDE.b8[HI] << " " <<
+				 std::hex << "RE " << (int)RDE.b8[LO] << " " <<
+				 std::hex << "RH " << (int)RHL.b8[HI] << " " <<
+				 std::hex << "RL " << (int)RHL.b8[LO] << " " << std::endl;
+}
+
@@ -1,7 +1,7 @@
 #include "Cartridge.h"
 #include "Gameboy.h"
 
-Cartridge::Cartridge(uint8_t* rom)
+Cartridge::Cartridge(const uint8_t* rom)
 {
 	for (int i = 0;i < 16; i++) title[i] = rom[ROM_TITLE_START + i];
 	for (int i = 0;i < 4; i++) manufacturer_code[i] = rom[MANUFACTURE_CODE_ADDR + i];
@@ -13,7 +13,7 @@ Cartridge::Cartridge(uint8_t* rom)
 	// calc ROM bank size (each 16KB)
 	rom_size_id = rom[ROM_SIZE_ADDR];
 	if (rom_size_id == 0x00) {
-		rom_size_banknum = 0;
+		rom_size_banknum = 2;
 	}
 	else if (rom_size_id < 0x08) {
 		rom_size_banknum = 1 << (rom_size_id + 1);
@@ -22,10 +22,11 @@ Cartridge::Cartridge(uint8_t* rom)
 	else if (rom_size_id == 0x53) rom_size_banknum = 80;
 	else if (rom_size_id == 0x54) rom_size_banknum = 96;
 
-	// calc ROM bank size (each 8KB)
+	// calc RAM bank size (each 8KB, id 0x01 is a single 2KB bank)
 	ram_size_id = rom[RAM_SIZE_ADDR];
-	if (ram_size_id < 0x03) ram_size_banknum = 0;
-	else if (ram_size_id == 0x03) ram_size_banknum = 0;
+	if (ram_size_id == 0x00) ram_size_banknum = 0;
+	else if (ram_size_id < 0x03) ram_size_banknum = 1;
+	else if (ram_size_id == 0x03) ram_size_banknum = 4;
 	else if (ram_size_id == 0x04) ram_size_banknum = 16;
 	else if (ram_size_id == 0x05) ram_size_banknum = 8;
 
@@ -35,3 +36,21 @@ Cartridge::Cartridge(uint8_t* rom)
 	header_checksum = rom[HEADER_CHECKSUM_ADDR];
 	global_checksum = rom[GLOBAL_CHECKSUM_ADDR];
 }
+
+// cartridge RAM keeps its contents while powered off
+bool Cartridge::has_battery() const
+{
+	switch (cartridge_type) {
+	case 0x03: case 0x06: case 0x09: case 0x0D: case 0x0F: case 0x10:
+	case 0x13: case 0x1B: case 0x1E: case 0xFF:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// external RAM in bytes
+uint32_t Cartridge::ram_size() const
+{
+	return ram_size_id == 0x01 ? 0x800 : ram_size_banknum * 0x2000;
+}
@@ -4,7 +4,9 @@
 class Cartridge
 {
 public:
-	Cartridge(uint8_t* rom);
+	Cartridge(const uint8_t* rom);
+	bool has_battery() const;
+	uint32_t ram_size() const;
 	char title[16];
 	char manufacturer_code[4];
 	uint8_t cgb_flag;
@@ -0,0 +1,35 @@
+#include "FrameExchange.h"
+
+// not thread safe, call before frames are exchanged
+void FrameExchange::resize(size_t frame_size) {
+	for (auto& buffer : buffers) buffer.assign(frame_size, 0);
+}
+
+bool FrameInfo::any_dirty() const {
+	for (uint64_t word : dirty)
+		if (word) return true;
+	return false;
+}
+
+void FrameExchange::publish() {
+	// the consumer has not taken the middle frame and will skip it. only the
+	// producer sets FRESH, so at worst the consumer takes it meanwhile and
+	// the merge marks a few tiles too many
+	const uint8_t pending = middle.load(std::memory_order_acquire);
+	if (pending & FRESH) {
+		FrameInfo& info = infos[back_index];
+		for (int i = 0; i < FRAME_DIRTY_WORDS; i++) info.dirty[i] |= infos[pending & INDEX_MASK].dirty[i];
+	}
+	const uint8_t old = middle.exchange(back_index | FRESH, std::memory_order_acq_rel);
+	back_index = old & INDEX_MASK;
+	sequence.fetch_add(1, std::memory_order_relaxed);
+}
+
+const uint8_t* FrameExchange::acquire() {
+	if (middle.load(std::memory_order_relaxed) & FRESH) {
+		// only this side clears FRESH, so the middle still holds a new frame
+		const uint8_t old = middle.exchange(front_index, std::memory_order_acq_rel);
+		front_index = old & INDEX_MASK;
+	}
+	return buffers[front_index].data();
+}
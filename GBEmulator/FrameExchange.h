@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define FRAME_DIRTY_WORDS	(8)	//up to 512 8x8 tiles, a 160x144 frame has 20x18
+
+// what changed in a frame: one bit per 8x8 tile, row major, set when the
+// tile differs from the previous frame, and a hash of the whole frame
+struct FrameInfo {
+	uint64_t hash = 0;
+	uint64_t dirty[FRAME_DIRTY_WORDS] = {};
+	bool tile_dirty(size_t tile) const { return dirty[tile >> 6] >> (tile & 63) & 1; }
+	void set_dirty(size_t tile) { dirty[tile >> 6] |= uint64_t(1) << (tile & 63); }
+	bool any_dirty() const;
+};
+
+// Triple buffered frame handoff between one producer (the GPU) and one
+// consumer (presenter, recorder, ...). The producer draws into back() and
+// publish()es it; the consumer acquire()s the newest published frame. The
+// two sides only meet in an atomic swap of the middle buffer index, so
+// neither waits for the other and no frame is copied. Each frame carries a
+// FrameInfo; dirty tiles of frames the consumer skipped are merged into
+// the next one, so the front frame's dirty bits are relative to the frame
+// the consumer had before.
+class FrameExchange
+{
+public:
+	void resize(size_t frame_size);
+	size_t frame_size() const { return buffers[0].size(); }
+
+	// producer: frame being drawn
+	uint8_t* back() { return buffers[back_index].data(); }
+	FrameInfo& back_info() { return infos[back_index]; }
+	// producer: the back frame becomes the newest, drawing moves to another buffer
+	void publish();
+
+	// consumer: newest published frame, valid until the next acquire()
+	const uint8_t* acquire();
+	const FrameInfo& front_info() const { return infos[front_index]; }
+	// consumer: a frame was published since the last acquire()
+	bool has_new() const { return middle.load(std::memory_order_acquire) & FRESH; }
+	uint64_t published() const { return sequence.load(std::memory_order_relaxed); }
+private:
+	static const uint8_t FRESH = 0x80;	//middle holds a frame the consumer has not seen
+	static const uint8_t INDEX_MASK = 0x03;
+	std::vector<uint8_t> buffers[3];
+	FrameInfo infos[3];
+	uint8_t back_index = 0;					//producer only
+	uint8_t front_index = 1;				//consumer only
+	std::atomic<uint8_t> middle = { 2 };
+	std::atomic<uint64_t> sequence = { 0 };	//frames published so far
+};
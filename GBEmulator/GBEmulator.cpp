@@ -2,10 +2,13 @@
 #include <fstream>
 #include <algorithm>
 #include <random>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <bitset>
 #include <GL/glut.h>
 #include "Gameboy.h"
-
-#define IMAGE_SIZE_IN_BYTE (3 * FRAME_WIDTH * FRAME_HEIGHT)
+#include "Scaler.h"
 
 #ifdef EMSCRIPTEN
     #include <emscripten/emscripten.h>
@@ -13,8 +16,9 @@
     #define EGL_EGLEXT_PROTOTYPES
 #endif
 
-std::unique_ptr<uint8_t[]> bitmap;
 Gameboy* GB;
+Profiler profiler;
+const char* profile_path = nullptr;
 
 const int modifier = 10;
  
@@ -22,19 +26,6 @@ const int modifier = 10;
 int display_width = FRAME_WIDTH * modifier;
 int display_height = FRAME_HEIGHT * modifier;
 
-//Create bitmap
-void create_bitmap(unsigned char* bitmap) {
-	for (int i = 0; i < FRAME_HEIGHT * FRAME_WIDTH; i++) {
-		for (int j=0;j<3;j++) 
-			bitmap[i * 3 + j] = 255 - GB->gpu.frame_buffer[i] * 64;
-	}
-}
-
-//Idle callback
-void idle(void) {
-	GB->cpu.step();
-}
-
 static KEYS char_to_key(const char c) 
 {
 	KEYS k;
@@ -52,9 +43,21 @@ static KEYS char_to_key(const char c)
 	return k;
 }
 
+//write the execution profile, if one was requested
+static void dump_profile()
+{
+	if (!profile_path) return;
+	if (profiler.dump(profile_path)) std::cout << "profile written to " << profile_path << std::endl;
+	else std::cerr << "Failed to write " << profile_path << std::endl;
+}
+
 //keyboard event callback
 void key_press(unsigned char key, int x, int y) 
 {
+	if (key == 'p') {
+		dump_profile();
+		return;
+	}
 	auto k = char_to_key(key);
 	if (k == KEYS::NOT_KEY) return;
 	GB->press(k);
@@ -66,11 +69,35 @@ void key_release(unsigned char key , int x , int y)
 	GB->release(k);
 }
 
-//Rasterize callback
+//Upload the 8x8 tiles that changed, a run of dirty tiles in a row at a time
+static void upload_frame(const uint8_t* frame, const FrameInfo& info)
+{
+#ifdef EMSCRIPTEN
+	//WebGL 1 has no GL_UNPACK_ROW_LENGTH
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, FRAME_WIDTH, FRAME_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)frame);
+#else
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, FRAME_WIDTH);
+	for (int ty = 0; ty < FRAME_TILES_Y; ty++) {
+		for (int tx = 0; tx < FRAME_TILES_X; tx++) {
+			if (!info.tile_dirty(ty * FRAME_TILES_X + tx)) continue;
+			int end = tx + 1;
+			while (end < FRAME_TILES_X && info.tile_dirty(ty * FRAME_TILES_X + end)) end++;
+			const uint8_t* pixels = frame + (static_cast<size_t>(ty) * 8 * FRAME_WIDTH + tx * 8) * 4;
+			glTexSubImage2D(GL_TEXTURE_2D, 0, tx * 8, ty * 8, (end - tx) * 8, 8, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)pixels);
+			tx = end;
+		}
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+#endif
+}
+
+//Rasterize callback, identical frames are not uploaded
 static void draw() {
-	create_bitmap(bitmap.get());
+	if (GB->gpu.frames().has_new()) {
+		const uint8_t* frame = GB->gpu.frames().acquire();
+		if (GB->gpu.frames().front_info().any_dirty()) upload_frame(frame, GB->gpu.frames().front_info());
+	}
 	glClear(GL_COLOR_BUFFER_BIT);
-	glTexSubImage2D(GL_TEXTURE_2D, 0 ,0, 0, FRAME_WIDTH, FRAME_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, (GLvoid*)bitmap.get());	
     glBegin( GL_QUADS );
         glTexCoord2d(0.0, 0.0);		glVertex2d(0.0,			  0.0);
         glTexCoord2d(1.0, 0.0); 	glVertex2d(display_width, 0.0);
@@ -95,12 +122,12 @@ void reshape_window(GLsizei w, GLsizei h)
 //Timer Callback
 static void timer(int value)
 {
-	GB->cpu.set_interrupt_flag(INTERRUPTS::V_BLANK);
-	if (GB->cpu.ready_for_render) {
-		GB->gpu.draw_frame();
-		GB->cpu.ready_for_render = false;
-		glutPostRedisplay();
+	auto status = GB->run_frame();
+	if (status == RUN_STATUS::ERROR) {
+		std::cerr << "emulation stopped" << std::endl;
+		return;
 	}
+	if (status == RUN_STATUS::FRAME_READY) glutPostRedisplay();
     glutTimerFunc(16, timer, 0);
 }
 
@@ -129,25 +156,140 @@ size_t read_file_and_copy(std::unique_ptr<uint8_t[]>& ptr, const char* filepath)
 	return sz;
 }
 
+//Run the core without window and report throughput, scaling every frame if a scaler is given
+static int run_headless(Gameboy& gb, uint32_t frames, Scaler* scaler)
+{
+	auto start = std::chrono::steady_clock::now();
+	uint32_t unchanged_frames = 0;
+	uint64_t dirty_tiles = 0;
+	std::vector<uint8_t> scaled(scaler ? static_cast<size_t>(scaler->output_width()) * scaler->output_height() : 0);
+	double scale_ns = 0;
+
+	for (uint32_t f = 0; f < frames; f++) {
+		auto status = gb.run_frame();
+		if (status == RUN_STATUS::ERROR) {
+			std::cerr << "emulation stopped at frame " << f << std::endl;
+			return 1;
+		}
+		const FrameInfo& changes = gb.gpu.frame_changes();
+		if (!changes.any_dirty()) unchanged_frames++;
+		for (uint64_t word : changes.dirty) dirty_tiles += std::bitset<64>(word).count();
+		if (scaler) {
+			auto scale_start = std::chrono::steady_clock::now();
+			scaler->run(gb.gpu.frame_buffer.get(), scaled.data());
+			scale_ns += static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - scale_start).count());
+		}
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	uint64_t instructions = gb.cpu.get_instruction_count();
+	double elapsed_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+	double elapsed_s = elapsed_ns / 1e9;
+
+	Log::flush();
+	dump_profile();
+	std::cout << std::dec << "frames: " << frames << std::endl;
+	std::cout << "instructions: " << instructions << std::endl;
+	std::cout << "pixel kernels: " << PixelOps::name(PixelOps::selected()) << std::endl;
+	std::cout << "unchanged frames: " << unchanged_frames << std::endl;
+	std::cout << "last frame hash: " << std::hex << gb.gpu.frame_changes().hash << std::dec << std::endl;
+	std::cout << "elapsed sec: " << elapsed_s << std::endl;
+	if (frames == 0 || elapsed_ns <= 0) return 0;
+	std::cout << "frames/sec: " << frames / elapsed_s << std::endl;
+	std::cout << "instructions/sec: " << instructions / elapsed_s << std::endl;
+	std::cout << "ns/frame: " << elapsed_ns / frames << std::endl;
+	std::cout << "dirty tiles/frame: " << static_cast<double>(dirty_tiles) / frames << std::endl;
+	if (scaler) std::cout << "scale " << scaler->output_width() << "x" << scaler->output_height() << " ns/frame: " << scale_ns / frames << std::endl;
+	return 0;
+}
+
+static void usage(const char* name)
+{
+	std::cerr << "usage: " << name << " [--rom path] [--boot path] [--save path.sav] [--headless] [--frames N] [--log all|cpu,interrupt,memory,mbc,input,system] [--profile out.csv|out.json] [--simd scalar|sse2|ssse3|avx2] [--scale scale2x|scale3x|scale4x|xbr2x|xbr4x] [--threads N]" << std::endl;
+}
+
 int main(int argc, char *argv[]) 
 {
 	//load cart
 	//const char* romfile = "rsrc/Tetris.gb";
 	const char* romfile = "rsrc/PokemonBlue.gb";
-	std::unique_ptr<uint8_t[]> rom;
-	std::size_t rom_size = read_file_and_copy(rom, romfile);
+	const char* boot_rom_path = "rsrc/DMG_ROM.bin";
+	const char* save_path = nullptr;
+	bool headless = false;
+	uint32_t frames = 600;
+	PIXEL_ISA simd = PIXEL_ISA::AVX2;
+	SCALER scaler_type = SCALER::SCALER_NUMS;	//no scaling
+	unsigned threads = std::thread::hardware_concurrency();
+
+	//parse options
+	for (int i = 1; i < argc; i++) {
+		if (!std::strcmp(argv[i], "--headless")) headless = true;
+		else if (!std::strcmp(argv[i], "--frames") && i + 1 < argc) frames = std::strtoul(argv[++i], nullptr, 10);
+		else if (!std::strcmp(argv[i], "--rom") && i + 1 < argc) romfile = argv[++i];
+		else if (!std::strcmp(argv[i], "--boot") && i + 1 < argc) boot_rom_path = argv[++i];
+		else if (!std::strcmp(argv[i], "--save") && i + 1 < argc) save_path = argv[++i];
+		else if (!std::strcmp(argv[i], "--log") && i + 1 < argc) {
+			if (!Log::enable(argv[++i])) {
+				usage(argv[0]);
+				return 1;
+			}
+		}
+		else if (!std::strcmp(argv[i], "--profile") && i + 1 < argc) profile_path = argv[++i];
+		else if (!std::strcmp(argv[i], "--scale") && i + 1 < argc) {
+			if (!Scaler::parse(argv[++i], scaler_type)) {
+				usage(argv[0]);
+				return 1;
+			}
+		}
+		else if (!std::strcmp(argv[i], "--threads") && i + 1 < argc) threads = std::strtoul(argv[++i], nullptr, 10);
+		else if (!std::strcmp(argv[i], "--simd") && i + 1 < argc) {
+			if (!PixelOps::parse(argv[++i], simd)) {
+				usage(argv[0]);
+				return 1;
+			}
+		}
+		else if (!std::strcmp(argv[i], "--help")) {
+			usage(argv[0]);
+			return 0;
+		}
+		//other args are left to glut
+	}
+#if !defined(GB_PROFILE) || !GB_PROFILE
+	if (profile_path) std::cerr << "built without GB_PROFILE, the profile will be empty" << std::endl;
+#endif
+
+	PixelOps::select(simd);	//best pixel kernels up to --simd
+
+	auto rom = RomImage::open(romfile);
+	if (!rom) {
+		std::cerr << "Failed to open file." << std::endl;
+		return 1;
+	}
 
 	//load boot rom
-	const char* boot_rom_path = "rsrc/DMG_ROM.bin";
 	std::unique_ptr<uint8_t[]> boot_rom;
 	std::size_t boot_rom_size = read_file_and_copy(boot_rom, boot_rom_path);
+	if (boot_rom_size == static_cast<std::size_t>(-1)) return 1;
 
 	//init GameBoy
-	Gameboy gb(rom.get(), rom_size, boot_rom.get());
+	//battery RAM is saved next to the ROM, headless runs only save with --save
+	std::string save_file = save_path ? save_path : "";
+	if (!save_path && !headless) save_file = std::string(romfile).substr(0, std::string(romfile).find_last_of('.')) + ".sav";
+
+	Gameboy gb(rom, boot_rom.get(), save_file);
 	gb.show_cart_info();
 	GB = &gb;
+	if (profile_path) gb.cpu.set_profiler(&profiler);
+
+	if (headless) {
+		if (scaler_type == SCALER::SCALER_NUMS) return run_headless(gb, frames, nullptr);
+		//the calling thread takes a band as well
+		ThreadPool pool(threads > 1 ? threads - 1 : 0);
+		Scaler scaler(scaler_type, FRAME_WIDTH, FRAME_HEIGHT, &pool);
+		return run_headless(gb, frames, &scaler);
+	}
 
-	bitmap = std::make_unique<uint8_t[]>(IMAGE_SIZE_IN_BYTE);
+	gb.gpu.set_output(PIXEL_FORMAT::RGBA8888);	//uploaded as is
 
 	//Init opengl
 	glutInit(&argc, argv);
@@ -157,15 +299,14 @@ int main(int argc, char *argv[])
 	glutCreateWindow("bitmap");
 	glutDisplayFunc(draw);
 	glutIgnoreKeyRepeat(GL_TRUE);	
-	glutIdleFunc(idle);
 	glutReshapeFunc(reshape_window);
 	glutTimerFunc(100, timer, 0);
 	glutKeyboardFunc(key_press);
 	glutKeyboardUpFunc(key_release);
 
 	glTexImage2D(
-		GL_TEXTURE_2D, 0, 3, FRAME_WIDTH, FRAME_HEIGHT,
-		0, GL_RGB, GL_UNSIGNED_BYTE, bitmap.get()
+		GL_TEXTURE_2D, 0, GL_RGBA, FRAME_WIDTH, FRAME_HEIGHT,
+		0, GL_RGBA, GL_UNSIGNED_BYTE, gb.gpu.frames().acquire()
 	);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -173,7 +314,8 @@ int main(int argc, char *argv[])
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP); 
 	glEnable(GL_TEXTURE_2D);
 
-	//main loop
+	//main loop, 'p' or exit writes the profile
+	std::atexit(dump_profile);
 	glutMainLoop();
 
 	return 0;
@@ -4,34 +4,16 @@
 #include <cstring>
 #include <algorithm>
 
-uint8_t OP_CYCLES[0x100] = {
-	//   0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
-	4,12, 8, 8, 4, 4, 8, 4,20, 8, 8, 8, 4, 4, 8, 4,    // 0x00
-	4,12, 8, 8, 4, 4, 8, 4, 8, 8, 8, 8, 4, 4, 8, 4,    // 0x10
-	8,12, 8, 8, 4, 4, 8, 4, 8, 8, 8, 8, 4, 4, 8, 4,    // 0x20
-	8,12, 8, 8,12,12,12, 4, 8, 8, 8, 8, 4, 4, 8, 4,    // 0x30
-	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,    // 0x40
-	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,    // 0x50
-	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,    // 0x60
-	8, 8, 8, 8, 8, 8, 4, 8, 4, 4, 4, 4, 4, 4, 8, 4,    // 0x70
-	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,    // 0x80
-	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,    // 0x90
-	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,    // 0xA0
-	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,    // 0xB0
-	8,12,12,12,12,16, 8,32, 8, 8,12, 8,12,12, 8,32,    // 0xC0
-	8,12,12, 0,12,16, 8,32, 8, 8,12, 0,12, 0, 8,32,    // 0xD0
-	12,12, 8, 0, 0,16, 8,32,16, 4,16, 0, 0, 0, 8,32,    // 0xE0
-	12,12, 8, 4, 0,16, 8,32,12, 8,16, 4, 0, 0, 8,32     // 0xF0
-};
-
-Gameboy::Gameboy(uint8_t* rom, size_t size, uint8_t* boot_rom) 
-	: cartridge(rom),
-	memory(std::make_unique<Memory>(cartridge, rom,size,boot_rom)),
-	rom_ptr(rom), 
-	rom_size(size)
+Gameboy::Gameboy(std::shared_ptr<const RomImage> rom, uint8_t* boot_rom, const std::string& save_path) 
+	: cartridge(rom->data()),
+	memory(std::make_unique<Memory>(cartridge, rom, boot_rom, save_path)),
+	rom(rom)
 {
+	memory->set_scheduler(&scheduler);
 	cpu.set_memmap(memory.get());
+	cpu.set_scheduler(&scheduler);
 	gpu.set_memmap(memory.get());
+	cpu.set_gpu(&gpu);
 }
 
 void Gameboy::show_title() {
@@ -46,1626 +28,424 @@ void Gameboy::show_title() {
 void Gameboy::show_cart_info() {
 	std::cout << "TITLE: ";
 	show_title();
-	std::cout << "ROM SIZE: " << rom_size << std::endl;
+	std::cout << "ROM SIZE: " << rom->size() << std::endl;
+}
+
+// run until LY reaches the V-blank line
+RUN_STATUS Gameboy::run_frame() {
+	cpu.ready_for_render = false;
+	return cpu.run(2 * LCD_FRAME_CYCLES);
+}
+
+// run until the cycle budget runs out or a frame is ready
+RUN_STATUS Gameboy::run_cycles(uint64_t cycles) {
+	cpu.ready_for_render = false;
+	return cpu.run(cycles);
 }
 
 void Gameboy::press(KEYS key) {
-	std::cout << "key pressed" << std::endl;
+	GB_LOG(INPUT, TRACE, "key pressed");
 	key_pressed[static_cast<int>(key)] = true;
 	memory->key &= ~(1 << static_cast<int>(key));
 }
 void Gameboy::release(KEYS key){
-	std::cout << "key released" << std::endl;
+	GB_LOG(INPUT, TRACE, "key released");
 	key_pressed[static_cast<int>(key)] = false;
 	memory->key |= 1 << static_cast<int>(key);
 }
 
-void CPU::shift_operation_CB() {
-	uint8_t op = memory->read(PC++);
-	uint8_t R  = (op & 0x7);
-	uint8_t B  = (op >> 3) & 0x7;
-	uint8_t D  = (op >> 3) & 0x1;
-	uint8_t val = 0;
-
-	// retrieve byte to manipulate
-	switch (R)
-	{
-		case 0: val = RBC.b8[HI]; break;
-		case 1: val = RBC.b8[LO]; break;
-		case 2: val = RDE.b8[HI]; break;
-		case 3: val = RDE.b8[LO]; break;
-		case 4: val = RHL.b8[HI]; break;
-		case 5: val = RHL.b8[LO]; break;
-		case 6: val = memory->read(RHL.b16); break;
-		case 7: val = RA; break;
-	}
-
-	// bit-fiddling OPs
-	uint8_t writeback = 1;
-	uint8_t N;
-	switch (op >> 6)
-	{
-		case 0x0:
-			op = (op >> 4) & 0x3;
-			switch (op)
-			{
-				case 0x0: // RdC R
-				case 0x1: // Rd R
-					if (D) // RRC R / RR R
-					{
-						N = val;
-						val = (val >> 1);
-						val |= op ? (FC << 7) : (N << 7);
-						FZ = (val == 0x00);
-						FN = FH = 0;
-						FC = (N & 0x01);
-					}
-					else    // RLC R / RL R
-					{
-						N = val;
-						val = (val << 1);
-						val |= op ? FC : (N >> 7);
-						FZ = (val == 0x00);
-						FN = FH = 0;
-						FC = (N >> 7);
-					}
-					break;
-				case 0x2:
-					if (D) // SRA R
-					{
-						FC = val & 0x01;
-						val = (val >> 1) | (val & 0x80);
-						FZ = (val == 0x00);
-						FN = FH = 0;
-					}
-					else    // SLA R
-					{
-						FC = (val >> 7);
-						val = val << 1;
-						FZ = (val == 0x00);
-						FN = FH = 0;
-					}
-					break;
-				case 0x3:
-					if (D) // SRL R
-					{
-						FC = val & 0x01;
-						val = val >> 1;
-						FZ = (val == 0x00);
-						FN = FH = 0;
-					}
-					else    // SWAP R
-					{
-						N = (val >> 4) & 0x0F;
-						N |= (val << 4) & 0xF0;
-						val = N;
-						FZ = (val == 0);
-						FN = FH = FC = 0;
-					}
-					break;
-			}
-			break;
-		case 0x1: // BIT B, R
-			FZ = !((val >> B) & 0x1);
-			FN = 0;
-			FH = 1;
-			writeback = 0;
-			break;
-		case 0x2: // RES B, R
-			val &= (0xFE << B) | (0xFF >> (8 - B));
-			break;
-		case 0x3: // SET B, R
-			val |= (0x1 << B);
-			break;
-	}
+GPU::GPU() {
+	frame_buffer= std::make_unique<uint8_t[]>(static_cast<size_t>(frame_height)*frame_width );
+	std::memset(frame_buffer.get(), 0, static_cast<size_t>(frame_height) * frame_width);
+	for (uint8_t ly = 0; ly < frame_height; ly++) line_hash[ly] = hash_line(ly);
+	update_lut();
+}
 
-	// save result
-	if (writeback)
-	{
-		switch (R)
-		{
-			case 0: RBC.b8[HI] = val; break;
-			case 1: RBC.b8[LO] = val; break;
-			case 2: RDE.b8[HI] = val; break;
-			case 3: RDE.b8[LO] = val; break;
-			case 4: RHL.b8[HI] = val; break;
-			case 5: RHL.b8[LO] = val; break;
-			case 6: memory->write(RHL.b16, val); break;
-			case 7: RA = val; break;
-		}
+// start writing a packed copy of each line, the current frame is converted
+// and published now. not thread safe, set it up before frames are consumed
+void GPU::set_output(PIXEL_FORMAT format) {
+	static const size_t pixel_size[] = { 0, 4, 2 };
+	output_format = format;
+	output_frames.resize(pixel_size[static_cast<int>(format)] * frame_width * frame_height);
+	if (format == PIXEL_FORMAT::NONE) return;
+	for (int i = 0; i < 3; i++) {
+		for (uint8_t ly = 0; ly < frame_height; ly++) write_output(ly);
+		output_frames.back_info() = last_frame_info;
+		for (int tile = 0; tile < FRAME_TILES_X * FRAME_TILES_Y; tile++) output_frames.back_info().set_dirty(tile);
+		output_frames.publish();
 	}
 }
 
-void CPU::set_memmap(Memory *mem) {
-	memory = mem;
+void GPU::set_shade_color(uint8_t shade, uint8_t r, uint8_t g, uint8_t b) {
+	shade_rgb[shade][0] = r;
+	shade_rgb[shade][1] = g;
+	shade_rgb[shade][2] = b;
+	update_lut();
+	for (uint8_t ly = 0; ly < frame_height; ly++) write_output(ly);
+	for (int tile = 0; tile < FRAME_TILES_X * FRAME_TILES_Y; tile++) frame_info.set_dirty(tile);	//every pixel changes color
 }
 
-void CPU::step() 
-{
-	if (ready_for_render) return;
-	if (!IME) HALT = 0;
-
-	// V-blank interrupt
-	if (IME&&
-		!!(memory->read(INTERRUPT_FLAG) & 1 << static_cast<uint8_t>(INTERRUPTS::V_BLANK)) &&
-		!!(memory->read(INTERRUPT_ENABLE) & 1 << static_cast<uint8_t>(INTERRUPTS::V_BLANK))) {
-		HALT = 0;
-		dump_reg();
-		std::cout << "V-blank interrupt\n";
-		IME = 0;
-		memory->write(--SP, PC >> 8);
-		memory->write(--SP, PC & 0xFF);
-		PC = VBLANK_INTR_ADDR;
-		uint8_t IF = memory->read(INTERRUPT_FLAG) ^ 1 << static_cast<uint8_t>(INTERRUPTS::V_BLANK);
-		memory->write(INTERRUPT_FLAG, IF);
-	}
-
-	// keypad interrupt
-	if (IME&&
-		!!(memory->read(INTERRUPT_FLAG) & 1 << static_cast<uint8_t>(INTERRUPTS::KEYPAD)) &&
-		!!(memory->read(INTERRUPT_ENABLE) & 1 << static_cast<uint8_t>(INTERRUPTS::KEYPAD))) {
-		HALT = 0;
-		dump_reg();
-		std::cout << "keypad interrupt\n";
-		IME = 0;
-		memory->write(--SP, PC >> 8);
-		memory->write(--SP, PC & 0xFF);
-		PC = KEYPAD_INTR_ADDR;
-		uint8_t IF = memory->read(INTERRUPT_FLAG) ^ 1 << static_cast<uint8_t>(INTERRUPTS::KEYPAD);
-		memory->write(INTERRUPT_FLAG, IF);
-	}
-
-	if (PC == BOOTROM_SIZE && memory->is_booting) {
-		std::cout << "finish boot seqence\n";
-		memory->is_booting = false;
+void GPU::update_lut() {
+	for (int shade = 0; shade < 4; shade++) {
+		const uint8_t* rgb = shade_rgb[shade];
+		const uint8_t rgba[4] = { rgb[0], rgb[1], rgb[2], 0xFF };
+		std::memcpy(&rgba_lut[shade], rgba, sizeof(rgba));
+		rgb565_lut[shade] = static_cast<uint16_t>((rgb[0] >> 3) << 11 | (rgb[1] >> 2) << 5 | rgb[2] >> 3);
 	}
+}
 
-	uint16_t tmp = PC;
-	uint8_t op = memory->read(PC++);
-	uint16_t NN;
-	uint32_t NNNN;
-	int8_t SN;
-	uint8_t N, D1, D2;
-
-	switch (op) {
-	case 0x00: //nop
-		break;
-	case 0x01:
-		RBC.b8[LO] = memory->read(PC++);
-		RBC.b8[HI] = memory->read(PC++);
-		break;
-	case 0x02:
-		memory->write(RBC.b16, RA);
-		break;
-	case 0x03:
-		NN = RBC.b16 + 1;
-		RBC.b8[HI] = NN >> 8;
-		RBC.b8[LO] = NN & 0xFF;
-		break;
-	case 0x04:
-		RBC.b8[HI]++;
-		FZ = (RBC.b8[HI] == 0x00);
-		FN = 0;
-		FH = ((RBC.b8[HI] & 0x0F) == 0x00);
-		break;
-	case 0x05:
-		RBC.b8[HI]--;
-		FZ = (RBC.b8[HI] == 0);
-		FN = 1;
-		FH = ((RBC.b8[HI] & 0x0F) == 0x0F);
-		break;
-	case 0x06:
-		RBC.b8[HI] = memory->read(PC++); //B
-		break;
-	case 0x07: // RLCA
-		RA = (RA << 1) | (RA >> 7);
-		FZ = FN = FH = 0;
-		FC = (RA & 0x01);
-		break;
-	case 0x08:
-		RBC.b8[LO] = memory->read(PC++);
-		break;
-	case 0x09:
-		NNNN = RHL.b16 + RBC.b16;
-		FN = 0;
-		FH = (NNNN ^ RHL.b16 ^ RBC.b16) & 0x1000 ? 1 : 0;
-		FC = (NNNN & 0xFFFF0000) ? 1 : 0;
-		RHL.b8[HI] = (NNNN & 0x0000FF00) >> 8;
-		RHL.b8[LO] = (NNNN & 0x000000FF);
-		break;
-	case 0x0A:
-		RA = memory->read(RBC.b16);
-		break;
-	case 0x0B:
-		NN = RBC.b16 - 1;
-		RBC.b8[HI] = NN >> 8;
-		RBC.b8[LO] = NN & 0xFF;
-		break;
-	case 0x0C:
-		RBC.b8[LO]++;
-		FZ = (RBC.b8[LO] == 0x00);
-		FN = 0;
-		FH = ((RBC.b8[LO] & 0x0F) == 0x00);
-		break;
-	case 0x0D:
-		RBC.b8[LO]--;
-		FZ = (RBC.b8[LO] == 0);
-		FN = 1;
-		FH = ((RBC.b8[LO] & 0x0F) == 0x0F);
-		break;
-	case 0x0E:
-		RBC.b8[LO] = memory->read(PC++); //B
-		break;
-	case 0x0F: // RRCA
-		FC = RA & 0x01;
-		RA = (RA >> 1) | (RA << 7);
-		FZ = 0;
-		FN = 0;
-		FH = 0;
-		break;
-	case 0x10:
-		std::cout << "HALT";
-		HALT = 1;
-		break;
-	case 0x11:
-		RDE.b8[LO] = memory->read(PC++); //B
-		RDE.b8[HI] = memory->read(PC++); //B
-		break;
-	case 0x12:
-		memory->write(RDE.b16, RA);
-		break;
-	case 0x13:
-		NN = RDE.b16 + 1;
-		RDE.b8[HI] = NN >> 8;
-		RDE.b8[LO] = NN & 0xFF;
-		break;
-	case 0x14:
-		RDE.b8[HI]++;
-		FZ = (RDE.b8[HI] == 0x00);
-		FN = 0;
-		FH = ((RDE.b8[HI] & 0x0F) == 0x00);
-		break;
-		break;
-	case 0x15:
-		RDE.b8[HI]--;
-		FZ = (RDE.b8[HI] == 0x00);
-		FN = 1;
-		FH = ((RDE.b8[HI] & 0x0F) == 0x0F);
-		break;
-	case 0x16:
-		RDE.b8[HI] = memory->read(PC++);
-		break;
-	case 0x17:
-		N = RA;
-		RA = RA << 1 | FC;
-		FZ = FN = FH = 0;
-		FC = (N >> 7) & 0x01;
-		break;
-	case 0x18:
-		SN = (int8_t)memory->read(PC++);
-		PC += SN;
-		break;
-	case 0x19:
-		NNNN = RHL.b16 + RDE.b16;
-		FN = 0;
-		FH = (NNNN ^ RHL.b16 ^ RDE.b16) & 0x1000 ? 1 : 0;
-		FC = (NNNN & 0xFFFF0000) ? 1 : 0;
-		RHL.b8[HI] = (NNNN & 0x0000FF00) >> 8;
-		RHL.b8[LO] = (NNNN & 0x000000FF);
-		break;
-	case 0x1A:
-		RA = memory->read(RDE.b16);
-		break;
-	case 0x1B:
-		NN = RDE.b16 - 1;
-		RDE.b8[HI] = NN >> 8;
-		RDE.b8[LO] = NN & 0xFF;
-		break;
-	case 0x1C:
-		RDE.b8[LO]++;
-		FZ = (RDE.b8[LO] == 0x00);
-		FN = 0;
-		FH = ((RDE.b8[LO] & 0x0F) == 0x00);
-		break;
-	case 0x1D:
-		RDE.b8[LO]--;
-		FZ = (RDE.b8[LO] == 0x00);
-		FN = 1;
-		FH = ((RDE.b8[LO] & 0x0F) == 0x0F);
-		break;
-	case 0x1E:
-		RDE.b8[LO] = memory->read(PC++);
-		break;
-	case 0x1F:
-		N = RA;
-		RA = RA >> 1 | (FC << 7);
-		FZ = FN = FH = 0;
-		FC = N & 0x1;
-		break;
-	case 0x20:
-		SN = (int8_t)memory->read(PC++);
-		if (!FZ) PC += SN;
-		break;
-	case 0x21:
-		RHL.b8[LO] = memory->read(PC++);
-		RHL.b8[HI] = memory->read(PC++);
-		break;
-	case 0x22:
-		memory->write(RHL.b16 ,RA);
-		NN = RHL.b16 + 1;
-		RHL.b8[HI] = NN >> 8;
-		RHL.b8[LO] = NN & 0xFF;
-		break;
-	case 0x23:
-		NN = RHL.b16 + 1;
-		RHL.b8[HI] = NN >> 8;
-		RHL.b8[LO] = NN & 0xFF;
-		break;
-	case 0x24:
-		RHL.b8[HI]++;
-		FZ = (RHL.b8[HI] == 0x00);
-		FN = 0;
-		FH = ((RHL.b8[HI] & 0x0F) == 0x00);
-		break;
-	case 0x25:
-		RHL.b8[HI]--;
-		FZ = (RHL.b8[HI] == 0x00);
-		FN = 1;
-		FH = ((RHL.b8[HI] & 0x0F) == 0x0F);
-		break;
-	case 0x26:
-		RHL.b8[HI] = memory->read(PC++);
-		break;
-	case 0x27:
-		D1 = RA >> 4;
-		D2 = RA & 0x0F;
-		if (FN)
-		{
-			if (FH) D2 -= 6;
-			if (FC) D1 -= 6;
-			if (D2 > 9) D2 -= 6;
-			if (D1 > 9)
-			{
-				D1 -= 6;
-				FC = 1;
-			}
-		}
-		break;
-	case 0x28:
-		SN = (int8_t)memory->read(PC++);
-		if (FZ) PC += SN;
-		break;
-	case 0x29:
-		NNNN = RHL.b16 + RHL.b16;
-		FN = 0;
-		FH = (NNNN & 0x1000) ? 1 : 0;
-		FC = (NNNN & 0xFFFF0000) ? 1 : 0;
-		RHL.b8[HI] = (NNNN & 0x0000FF00) >> 8;
-		RHL.b8[LO] = (NNNN & 0x000000FF);
-		break;
-	case 0x2A:
-		RA = memory->read(RHL.b16);
-		NN = RHL.b16 + 1;
-		RHL.b8[HI] = NN >> 8;
-		RHL.b8[LO] = NN & 0xFF;
-		break;
-	case 0x2B:
-		NN = RHL.b16 - 1;
-		RHL.b8[HI] = NN >> 8;
-		RHL.b8[LO] = NN & 0xFF;
-		break;
-	case 0x2C:
-		RHL.b8[LO]++;
-		FZ = (RHL.b8[LO] == 0x00);
-		FN = 0;
-		FH = ((RHL.b8[LO] & 0x0F) == 0x00);
-		break;
-	case 0x2D:
-		RHL.b8[LO]--;
-		FZ = (RHL.b8[LO] == 0x00);
-		FN = 1;
-		FH = ((RHL.b8[LO] & 0x0F) == 0x0F);
-		break;
-	case 0x2E:
-		RHL.b8[LO] = memory->read(PC++);
-		break;
-	case 0x2F:
-		RA = RA ^ 0xFF;
-		FN = FH = 1;
-		break;
-	case 0x30: // JP NC, imm
-		SN = (int8_t)memory->read(PC++);
-		if (!FC) PC += SN;
-		break;
-	case 0x31:
-		SP = memory->read(PC++);
-		SP |= memory->read(PC++) << 8;
-		break;
-	case 0x32:
-		memory->write(RHL.b16,  RA);
-		NN = RHL.b16 - 1;
-		RHL.b8[HI] = NN >> 8;
-		RHL.b8[LO] = NN & 0xFF;
-		break;
-	case 0x34:
-		N = memory->read(RHL.b16) + 1;
-		FZ = (N == 0x00);
-		FN = 0;
-		FH = ((N & 0x0F) == 0x00);
-		memory->write(RHL.b16, N);
-		break;
-	case 0x35:
-		N = memory->read(RHL.b16) - 1;
-		FZ = (N == 0x00);
-		FN = 1;
-		FH = ((N & 0x0F) == 0x0F);
-		memory->write(RHL.b16, N);
-		break;
-	case 0x36:
-		memory->write(RHL.b16, memory->read(PC++));
-		break;
-	case 0x37:
-		FN = FH = 0;
-		FC = 1;
-		break;
-	case 0x38:
-		SN = (int8_t)memory->read(PC++);
-		if (FC)
-		{
-			PC += SN;
-		}
-		break;
-	case 0x39: // ADD HL, SP
-		NNNN = RHL.b16 + SP;
-		FN = 0;
-		FH = (NNNN ^ RHL.b16 ^ SP) & 0x1000 ? 1 : 0;
-		FC = (NNNN & 0xFFFF0000) ? 1 : 0;
-		RHL.b8[HI] = (NNNN & 0x0000FF00) >> 8;
-		RHL.b8[LO] = (NNNN & 0x000000FF);
-		break;
-	case 0x3A:
-		RA = memory->read(RHL.b16);
-		NN = RHL.b16 - 1;
-		RHL.b8[HI] = NN >> 8;
-		RHL.b8[LO] = NN & 0xFF;
-		break;
-	case 0x3B: // DEC SP
-		SP--;
-		break;
-	case 0x3C:
-		RA++;
-		FZ = (RA == 0x00);
-		FN = 0;
-		FH = ((RA & 0x0F) == 0x00);
-		break;
-	case 0x3D:
-		RA--;
-		FZ = (RA == 0x00);
-		FN = 1;
-		FH = ((RA & 0x0F) == 0x0F);
-		break;
-	case 0x3E:
-		RA = memory->read(PC++);
-		break;
-	case 0x3F:
-		FN = FH = 0;
-		FC = FC ^ 0x1;
-		break;
-	case 0x40://do nothing
-		break;
-	case 0x41: // LD B, C
-		RBC.b8[HI] = RBC.b8[LO];
-		break;
-	case 0x42:
-		RBC.b8[HI] = RDE.b8[HI];
-		break;
-	case 0x43: // LD B, E
-		RBC.b8[HI] = RDE.b8[LO];
-		break;
-	case 0x44:
-		RBC.b8[HI] = RHL.b8[HI];
-		break;
-	case 0x45: // LD B, L
-		RBC.b8[HI] = RHL.b8[LO];
-		break;
-	case 0x46:	
-		RBC.b8[HI] = memory->read(RHL.b16);
-		break;
-	case 0x47:
-		RBC.b8[HI] = RA;
-		break;
-	case 0x48: // LD C, B
-		RBC.b8[LO] = RBC.b8[HI];
-		break;
-	case 0x49: // LD C, C
-		break;
-	case 0x4A: // LD C, D
-		RBC.b8[LO] = RDE.b8[HI];
-	case 0x4B: // LD C, E
-		RBC.b8[LO] = RDE.b8[LO];
-		break;
-	case 0x4C: // LD C, H
-		RBC.b8[LO] = RHL.b8[HI];
-		break;
-	case 0x4D: // LD C, L
-		RBC.b8[LO] = RHL.b8[LO];
-		break;
-	case 0x4E:	
-		RBC.b8[LO] = memory->read(RHL.b16);
-		break;
-	case 0x4F:
-		RBC.b8[LO] = RA;
-		break;
-	case 0x50:
-		RDE.b8[HI] = RBC.b8[HI];
-		break;
-	case 0x51:
-		RDE.b8[HI] = RBC.b8[LO];
-		break;
-	case 0x52:// do nothing
-		break;
-	case 0x53:
-		RDE.b8[HI] = RDE.b8[LO];
-		break;
-	case 0x54:
-		RDE.b8[HI] = RHL.b8[HI];
-		break;
-	case 0x55:
-		RDE.b8[HI] = RHL.b8[LO];
-		break;
-	case 0x56:
-		RDE.b8[HI] = memory->read(RHL.b16);
-		break;
-	case 0x57:
-		RDE.b8[HI] = RA;
-		break;
-	case 0x58:
-		RDE.b8[LO] = RBC.b8[HI];
-		break;
-	case 0x59:
-		RDE.b8[LO] = RDE.b8[HI];
-		break;
-	case 0x5B://do nothing
-		break;
-	case 0x5C:
-		RDE.b8[LO] = RHL.b8[HI];
-		break;
-	case 0x5D:
-		RDE.b8[LO] = RHL.b8[LO];
-		break;
-	case 0x5E:
-		RDE.b8[LO] = memory->read(RHL.b16);
-		break;
-	case 0x5F:
-		RDE.b8[LO] = RA;
-		break;
-	case 0x60:
-		RHL.b8[HI] = RBC.b8[HI];
-		break;
-	case 0x61:
-		RHL.b8[HI] = RBC.b8[LO];
-		break;
-	case 0x62:
-		RHL.b8[HI] = RDE.b8[HI];
-		break;
-	case 0x66:
-		RHL.b8[HI] = memory->read(RHL.b16);
-		break;
-	case 0x67:
-		RHL.b8[HI] = RA;
-		break;
-	case 0x68: // LD L, B
-		RHL.b8[LO] = RBC.b8[HI];
-		break;
-	case 0x69:
-		RHL.b8[LO] = RBC.b8[LO];
-		break;
-	case 0x6A: // LD L, D
-		RHL.b8[LO] = RDE.b8[HI];
-		break;
-	case 0x6B:
-		RHL.b8[LO] = RDE.b8[LO];
-		break;
-	case 0x6C: // LD L, H
-		RHL.b8[LO] = RHL.b8[HI];
-		break;
-	case 0x6D: // LD L, L
-		break;
-	case 0x6E: // LD L, (HL)
-		RHL.b8[LO] = memory->read(RHL.b16);
-		break;
-	case 0x6F:
-		RHL.b8[LO] = RA;
-		break;	
-	case 0x70:
-		memory->write(RHL.b16, RBC.b8[HI]);
-		break;
-	case 0x71:
-		memory->write(RHL.b16, RBC.b8[LO]);
-		break;
-	case 0x72:
-		memory->write(RHL.b16, RDE.b8[HI]);
-		break;
-	case 0x73:
-		memory->write(RHL.b16, RDE.b8[LO]);
-		break;
-	case 0x74:
-		memory->write(RHL.b16, RHL.b8[HI]);
-		break;
-	case 0x75:
-		memory->write(RHL.b16, RHL.b8[LO]);
-		break;
-	case 0x76:
-		//TODO
-		break;
-	case 0x77:
-		memory->write(RHL.b16,  RA);
-		break;
-	case 0x78:
-		RA = RBC.b8[HI];
-		break;
-	case 0x79:
-		RA = RBC.b8[LO];
-		break;
-	case 0x7A:
-		RA = RDE.b8[HI];
-		break;
-	case 0x7B:
-		RA = RDE.b8[LO];
-		break;
-	case 0x7C:
-		RA = RHL.b8[HI];
-		break;
-	case 0x7D:
-		RA = RHL.b8[LO];
-		break;
-	case 0x7E:
-		RA = memory->read(RHL.b16);
-		break;
-	case 0x7F:
-		break;
-	case 0x80:
-		NN = RA + RBC.b8[HI];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ RBC.b8[HI] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x81: // ADD A, C
-		NN = RA + RBC.b8[LO];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ RBC.b8[LO] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-	case 0x82:
-		NN = RA + RDE.b8[HI];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ RDE.b8[HI] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x83: // ADD A, E
-		NN = RA + RDE.b8[LO];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ RDE.b8[LO] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x85:
-		NN = RA + RHL.b8[LO];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ RHL.b8[LO] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x86:
-		N = memory->read(RHL.b16);
-		NN = RA + N;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x87:
-		NN = RA + RA;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = NN & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x88: // ADC A, B
-		N = RBC.b8[HI];
-		NN = RA + N + FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x89:
-		N = RBC.b8[LO];
-		NN = RA + N + FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x8A:
-		N = RDE.b8[HI];
-		NN = RA + N + FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x8C:
-		N = RHL.b8[HI];
-		NN = RA + N + FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x8D:
-		N = RHL.b8[LO];
-		NN = RA + N + FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x8E: // ADC A, (HL)
-		N = memory->read(RHL.b16);
-		NN = RA + N + FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x8F: // ADC A, A
-		N = RA;
-		NN = RA + N + FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x90:
-		NN = RA - RBC.b8[HI];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ RBC.b8[HI] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x91: // SUB C
-		NN = RA - RBC.b8[LO];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ RBC.b8[LO] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x92: // SUB D
-		NN = RA - RDE.b8[HI];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ RDE.b8[HI] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x93: // SUB E
-		NN = RA - RDE.b8[LO];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ RDE.b8[LO] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x94: // SUB H
-		NN = RA - RHL.b8[HI];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ RHL.b8[HI] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x95: // SUB L
-		NN = RA - RHL.b8[LO];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ RHL.b8[LO] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x96:
-		N = memory->read(RHL.b16);
-		NN = RA - N;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x97:
-		RA = 0x00;
-		FZ = FN = 1;
-		FH = FC = 0;
-		break;
-	case 0x98:
-		N = RBC.b8[HI];
-		NN = RA - N - FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x99:
-		N = RBC.b8[LO];
-		NN = RA - N - FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
+void GPU::write_output(uint8_t ly) {
+	const uint8_t* line = &frame_buffer[static_cast<size_t>(ly) * frame_width];
+	const size_t offset = static_cast<size_t>(ly) * frame_width;
+	switch (output_format) {
+	case PIXEL_FORMAT::RGBA8888: {
+		uint32_t* out = reinterpret_cast<uint32_t*>(output_frames.back()) + offset;
+		for (int x = 0; x < frame_width; x++) out[x] = rgba_lut[line[x]];
 		break;
-	case 0x9A:
-		N = RDE.b8[HI];
-		NN = RA - N - FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x9B:
-		N = RDE.b8[LO];
-		NN = RA - N - FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x9C:
-		N = RHL.b8[HI];
-		NN = RA - N - FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x9D:
-		N = RHL.b8[LO];
-		NN = RA - N - FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x9E:
-		N = memory->read(RHL.b16);
-		NN = RA - N - FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0x9F:
-		RA = FC ? 0xFF : 0x00;
-		FZ = FC ? 0x00 : 0x01;
-		FN = 1;
-		FH = FC;
-		break;
-	case 0xA0:
-		RA = RA & RBC.b8[HI];
-		FZ = (RA == 0x00);
-		FN = 0;
-		FH = 1;
-		FC = 0;
-		break;
-	case 0xA1:
-		RA = RA & RBC.b8[LO];
-		FZ = (RA == 0x00);
-		FN = 0;
-		FH = 1;
-		FC = 0;
-		break;
-	case 0xA2:
-		RA = RA & RDE.b8[HI];
-		FZ = (RA == 0x00);
-		FN = 0;
-		FH = 1;
-		FC = 0;
-		break;
-	case 0xA3:
-		RA = RA & RDE.b8[LO];
-		FZ = (RA == 0x00);
-		FN = 0;
-		FH = 1;
-		FC = 0;
-		break;
-	case 0xA4:
-		RA = RA & RHL.b8[HI];
-		FZ = (RA == 0x00);
-		FN = 0;
-		FH = 1;
-		FC = 0;
-		break;
-	case 0xA5:
-		RA = RA & RHL.b8[LO];
-		FZ = (RA == 0x00);
-		FN = 0;
-		FH = 1;
-		FC = 0;
-		break;
-	case 0xA6:
-		RA = RA & memory->read(RHL.b16);
-		FZ = (RA == 0x00);
-		FN = 0;
-		FH = 1;
-		FC = 0;
-		break;
-	case 0xA7:
-		FZ = (RA == 0x00);
-		FN = 0;
-		FH = 1;
-		FC = 0;
-		break;
-	case 0xA8:
-		RA = RA ^ RBC.b8[HI];
-		FZ = (RA == 0x00);
-		FN = FH = FC = 0;
-		break;
-	case 0xA9:
-		RA = RA ^ RBC.b8[LO];
-		FZ = (RA == 0x00);
-		FN = FH = FC = 0;
-		break;
-	case 0xAA: // XOR D
-		RA = RA ^ RDE.b8[HI];
-		FZ = (RA == 0x00);
-		FN = 0;
-		FH = 0;
-		FC = 0;
-		break;
-	case 0xAB: // XOR E
-		RA = RA ^ RDE.b8[LO];
-		FZ = (RA == 0x00);
-		FN = 0;
-		FH = 0;
-		FC = 0;
-		break;
-	case 0xAC: // XOR H
-		RA = RA ^ RHL.b8[HI];
-		FZ = (RA == 0x00);
-		FN = 0;
-		FH = 0;
-		FC = 0;
-		break;
-	case 0xAD: // XOR L
-		RA = RA ^ RHL.b8[LO];
-		FZ = (RA == 0x00);
-		FN = 0;
-		FH = 0;
-		FC = 0;
-		break;
-	case 0xAE:
-		RA = RA ^ memory->read(RHL.b16);
-		FZ = (RA == 0x00);
-		FN = FH = FC = 0;
-		break;
-	case 0xAF:
-		RA = 0x00;
-		FZ = 1;
-		FN = FH = FC = 0;
-		break;
-	case 0xB0:
-		RA = RA | RBC.b8[HI];
-		FZ = (RA == 0x00);
-		FN = FH = FC = 0;
-		break;
-	case 0xB1:
-		RA = RA | RBC.b8[LO];
-		FZ = (RA == 0x00);
-		FN = FH = FC = 0;
-		break;
-	case 0xB2:
-		RA = RA | RDE.b8[HI];
-		FZ = (RA == 0x00);
-		FN = FH = FC = 0;
-		break;
-	case 0xB3:
-		RA = RA | RDE.b8[LO];
-		FZ = (RA == 0x00);
-		FN = FH = FC = 0;
-		break;
-	case 0xB4:
-		RA = RA | RHL.b8[HI];
-		FZ = (RA == 0x00);
-		FN = FH = FC = 0;
-		break;
-	case 0xB5:
-		RA = RA | RHL.b8[LO];
-		FZ = (RA == 0x00);
-		FN = FH = FC = 0;
-		break;
-	case 0xB6:
-		RA = RA | memory->read(RHL.b16);
-		FZ = (RA == 0x00);
-		FN = FH = FC = 0;
-		break;
-	case 0xB7:
-		FZ = (RA == 0x00);
-		FN = FH = FC = 0;
-		break;
-	case 0xB8:
-		NN = RA - RBC.b8[HI];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ RBC.b8[HI] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		break;
-	case 0xB9:
-		NN = RA - RBC.b8[LO];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ RBC.b8[LO] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		break;
-	case 0xBA:
-		NN = RA - RDE.b8[HI];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ RDE.b8[HI] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		break;
-	case 0xBB:
-		NN = RA - RDE.b8[LO];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ RDE.b8[LO] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		break;
-	case 0xBC:
-		NN = RA - RHL.b8[HI];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ RHL.b8[HI] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		break;
-	case 0xBD:
-		NN = RA - RHL.b8[LO];
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ RHL.b8[LO] ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		break;
-	case 0xBE:
-		N = memory->read(RHL.b16);
-		NN = RA - N;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		break;
-	case 0xBF:
-		FZ = FN = 1;
-		FH = FC = 0;
-		break;
-	case 0xC0:
-		if (!FZ)
-		{
-			NN = memory->read(SP++);
-			NN |= memory->read(SP++) << 8;
-			PC = NN;
-		}
-		break;
-	case 0xC1:
-		RBC.b8[LO] = memory->read(SP++);
-		RBC.b8[HI] = memory->read(SP++);
-		break;
-	case 0xC2:
-		NN = memory->read(PC++);
-		NN |= memory->read(PC++) << 8;
-		if (!FZ) PC = NN;
-		break;
-	case 0xC3:
-		NN = memory->read(PC++);
-		NN |= memory->read(PC++) << 8;
-		PC = NN;
-		break;
-	case 0xC5:
-		memory->write(--SP,RBC.b8[HI]);
-		memory->write(--SP,RBC.b8[LO]);
-		break;
-	case 0xC6: // ADD A, imm
-		N = memory->read(PC++);
-		NN = RA + N;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0xC7:
-		memory->write(--SP, PC >> 8);
-		memory->write(--SP, PC & 0xFF);
-		PC = 0x0000;
-		break;
-	case 0xC8:
-		if (FZ)
-		{
-			NN = memory->read(SP++);
-			NN |= memory->read(SP++) << 8;
-			PC = NN;
-		}
-		break;
-	case 0xC9:
-		NN = memory->read(SP++);
-		NN |= memory->read(SP++) << 8;
-		PC = NN;
-		break;
-	case 0xCA:
-		NN =  memory->read(PC++);
-		NN |= memory->read(PC++) << 8;
-		if (FZ) PC = NN;
-		break;
-	case 0xCB:
-		shift_operation_CB();
-		break;
-	case 0xCC:	// CALL Z, imm
-		NN = memory->read(PC++);
-		NN |= memory->read(PC++) << 8;
-		if (FZ)
-		{
-			memory->write(--SP, PC >> 8);
-			memory->write(--SP, PC & 0xFF);
-			PC = NN;
-		}
-		break;
-	case 0xCD:
-		NN = memory->read(PC++);
-		NN |= memory->read(PC++) << 8;
-		memory->write(--SP , PC >> 8);
-		memory->write(--SP , PC & 0xFF);
-		PC = NN;
-		break;
-	case 0xCE:
-		N = memory->read(PC++);
-		NN = RA + N + FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 0;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0xCF: 
-		memory->write(--SP, PC >> 8);
-		memory->write(--SP, PC & 0xFF);
-		PC = 0x0008;
-		break;
-	case 0xD0: // RET NC
-		if (!FC)
-		{
-			NN =  memory->read(SP++);
-			NN |= memory->read(SP++) << 8;
-			PC = NN;
-		}
-		break;
-	case 0xD1:
-		RDE.b8[LO] = memory->read(SP++);
-		RDE.b8[HI] = memory->read(SP++);
-		break;
-	case 0xD2:
-		NN =  memory->read(PC++);
-		NN |= memory->read(PC++) << 8;
-		if (!FC) PC = NN;
-		break;
-	case 0xD5:
-		memory->write(--SP,RDE.b8[HI]);
-		memory->write(--SP,RDE.b8[LO]);
-		break;
-	case 0xD6:
-		N = memory->read(PC++);
-		NN = RA - N;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0xD7:
-		memory->write(--SP, PC >> 8);
-		memory->write(--SP, PC & 0xFF);
-		PC = 0x0010;
-		break;
-	case 0xD8:
-		if (FC)
-		{
-			NN = memory->read(SP++);
-			NN |= memory->read(SP++) << 8;
-			PC = NN;
-		}
-		break;
-	case 0xD9:
-		NN = memory->read(SP++);
-		NN |= memory->read(SP++) << 8;
-		PC = NN;
-		IME = 1;
-		break;
-	case 0xDA: // JP C, imm
-		NN = memory->read(PC++);
-		NN |= memory->read(PC++) << 8;
-		if (FC)
-		{
-			PC = NN;
-		}
-		break;
-	case 0xDB: // illegal
-		break;
-	case 0xDC: // CALL C, imm
-		NN = memory->read(PC++);
-		NN |= memory->read(PC++) << 8;
-		if (FC)
-		{
-			memory->write(--SP, PC >> 8);
-			memory->write(--SP, PC & 0xFF);
-			PC = NN;
-		}
-		break;
-	case 0xDD: // illegal
-		break;
-	case 0xDE:
-		N = memory->read(PC++);
-		NN = RA - N - FC;
-		FZ = ((NN & 0xFF) == 0x00);
-		FN = 1;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		RA = NN & 0xFF;
-		break;
-	case 0xE0:
-		memory->write((0xFF00 | memory->read(PC++)),  RA);
-		break;
-	case 0xE1:
-		RHL.b8[LO] = memory->read(SP++);
-		RHL.b8[HI] = memory->read(SP++);
-		break;
-	case 0xE2:
-		memory->write(0xFF00 | RBC.b8[LO], RA);
-		break;
-	case 0xE5:
-		memory->write(--SP,RHL.b8[HI]);
-		memory->write(--SP,RHL.b8[LO]);
-		break;
-	case 0xE6:
-		RA = RA & memory->read(PC++);
-		FZ = (RA == 0x00);
-		FN = FC = 0;
-		FH = 1;
-		break;
-	case 0xE9:
-		PC = RHL.b16;
-		break;
-	case 0xEA:
-		memory->write(memory->read(PC++) |memory->read(PC++)<<8,  RA);
-		break;
-	case 0xEB: // illegal
-		break;
-	case 0xEC: // illegal
-		break;
-	case 0xED: // illegal
-		break;
-	case 0xEE:
-		RA = RA ^ memory->read(PC++);
-		FZ = (RA == 0x00);
-		FN = FH = FC = 0;
-		break;
-	case 0xEF:
-		memory->write(--SP, PC >> 8);
-		memory->write(--SP, PC & 0xFF);
-		PC = 0x0028;
-		break;
-	case 0xF0:
-		RA = memory->read((0xFF00 | memory->read(PC++)));
-		break;
-	case 0xF1:
-		N = memory->read(SP++);
-		FZ = (N >> 7) & 1;
-		FN = (N >> 6) & 1;
-		FH = (N >> 5) & 1;
-		FC = (N >> 4) & 1;
-		RA = memory->read(SP++);
-		break;
-	case 0xF3:
-		std::cout << "disable IME\n";
-		IME = 0;
-		break;
-	case 0xF5:
-		memory->write(--SP , RA);
-		memory->write(--SP , FZ<<7|FN<<6|FH<<5|FC<<4);
-		break;
-	case 0xF6:
-		RA = RA | memory->read(PC++);
-		FZ = (RA == 0x00);
-		FN = FH = FC = 0;
-		break;
-	case 0xF7:
-		memory->write(--SP, PC >> 8);
-		memory->write(--SP, PC & 0xFF);
-		PC = 0x0030;
-		break;
-	case 0xF8: // LD HL, SP+/-imm
-		SN = (int8_t)memory->read(PC++);
-		NN = SP + SN;
-		if (SN >= 0)
-		{
-			FZ = 0;
-			FN = 0;
-			FH = ((SP ^ SN ^ NN) & 0x1000) ? 1 : 0;
-			FC = (SP > NN);
-		}
-		else
-		{
-			FZ = 0;
-			FN = 0;
-			FH = ((SP ^ SN ^ NN) & 0x1000) ? 1 : 0;
-			FC = (SP < NN);
-		}
-		RHL.b8[HI] = (NN & 0xFF00) >> 8;
-		RHL.b8[LO] = (NN & 0x00FF);
-		break;
-	case 0xF9:
-		SP = RHL.b16;
-		break;
-	case 0xFA:
-		RA = memory->read( memory->read(PC++) | memory->read(PC++) << 8);
-		break;
-	case 0xFB:
-		IME = 1;
-		break;
-	case 0xFE:
-		N = memory->read(PC++);
-		NN = RA - N;
-		FZ = ((NN & 0xFF) == 0);
-		FN = 1;
-		FH = (RA ^ N ^ NN) & 0x10 ? 1 : 0;
-		FC = (NN & 0xFF00) ? 1 : 0;
-		break;
-	case 0xFF:
-		memory->write(--SP, PC >> 8);
-		memory->write(--SP, PC & 0xFF);
-		PC = 0x0038;
+	}
+	case PIXEL_FORMAT::RGB565: {
+		uint16_t* out = reinterpret_cast<uint16_t*>(output_frames.back()) + offset;
+		for (int x = 0; x < frame_width; x++) out[x] = rgb565_lut[line[x]];
 		break;
+	}
 	default:
-		std::cout << "Operation not inplemented : " << std::hex << (int)op << std::endl;//todo for debug
-		dump_reg();
-		while (1);
+		break;
 	}
+}
 
-	cycle_count += OP_CYCLES[op];
-	lcd_count += OP_CYCLES[op];
-	div_count += OP_CYCLES[op];
+void GPU::set_memmap(Memory* mem) {
+	memory = mem;
+}
 
-	//increment div counter
-	if (div_count > CLOCK_FREQUENCY / DIV_COUNTER_INCREMENT_FREQUENCY) {
-		div_count = 0;
-		memory->write(DIV_REGISTER, memory->read(DIV_REGISTER)+1);
+// 8 color numbers of one tile row, tiles 0-255 at 0x8000, 256-383 at 0x9000
+const uint8_t* GPU::tile_row(uint16_t tile, uint8_t y, bool x_flip) {
+	uint8_t* decoded = &tile_cache[tile * 64];
+	const uint32_t generation = memory->get_tile_generation(tile);
+	if (tile_cache_generation[tile] != generation) {
+		uint8_t* flipped = decoded + TILE_NUM * 64;
+		const uint16_t tile_addr = 0x8000 + tile * 16;
+		for (int k = 0; k < 8; k++) {
+			PixelOps::decode_row(memory->read(tile_addr + k * 2), memory->read(tile_addr + k * 2 + 1), decoded + k * 8);
+			for (int l = 0; l < 8; l++) flipped[k * 8 + 7 - l] = decoded[k * 8 + l];
+		}
+		tile_cache_generation[tile] = generation;
 	}
+	return decoded + (x_flip ? TILE_NUM * 64 : 0) + y * 8;
+}
 
-	if (lcd_count > LCD_LINE_CYCLES) {
-		memory->write( LCDC_Y_CORDINATE , (memory->read(LCDC_Y_CORDINATE) + 1) % LCD_VERT_LINES);
-		lcd_count -= LCD_LINE_CYCLES;
-		if (memory->read(LCDC_Y_CORDINATE) == FRAME_HEIGHT) {
-			ready_for_render = true;
+// copy the tiles of one map row from map_x on as color numbers, starting
+// at screen x from. the row wraps after 32 tiles
+void GPU::fetch_tiles(uint8_t* colors, int from, uint16_t map_row, uint8_t map_x, uint8_t tile_y, bool unsigned_ids) {
+	int x = from - (map_x & 7);	//left edge of the first tile, may be off screen
+	for (uint8_t column = map_x >> 3; x < frame_width; x += 8, column = (column + 1) & 31) {
+		const uint8_t id = memory->read(map_row + column);
+		const uint8_t* row = tile_row(unsigned_ids ? id : 256 + static_cast<int8_t>(id), tile_y, false);
+		if (x >= from && x + 8 <= frame_width) {
+			std::memcpy(colors + x, row, 8);
+			continue;
+		}
+		for (int l = 0; l < 8; l++) {
+			if (x + l < from || x + l >= frame_width) continue;
+			colors[x + l] = row[l];
 		}
 	}
 }
-void CPU::set_interrupt_flag(INTERRUPTS intrpt) {
-	memory->write( INTERRUPT_FLAG , memory->read(INTERRUPT_FLAG) | 1 << static_cast<uint8_t>(intrpt) );
+
+// draw line ly into frame_buffer with the registers as they are now, so
+// scroll and LCDC changes between lines show up. the last line completes
+// the frame for the output consumer
+void GPU::draw_line(uint8_t ly) {
+	if (ly >= frame_height) return;
+	uint8_t line[FRAME_WIDTH] = {};	//LCD off shows a blank screen
+	const uint8_t lcdc = memory->read(LCDC);
+	if (lcdc >> 7 & 0x01) compose_line(ly, lcdc, line);
+	update_line(ly, line);
+
+	if (output_format != PIXEL_FORMAT::NONE) write_output(ly);
+	if (ly == frame_height - 1) finish_frame();
 }
 
-void CPU::dump_reg() {
-	int op = memory->read(PC);
-	std::cout << std::hex << "PC " << (int)PC << " " <<
-		         std::hex << "OP " << (int)op << " " << 
-				 std::hex << "RA " << (int)RA << " " <<
-				 std::hex << "RB " << (int)RBC.b8[HI] << " " <<
-				 std::hex << "RC " << (int)RBC.b8[LO] << " " <<
-				 std::hex << "RD " << (int)RDE.b8[HI] << " " <<
-				 std::hex << "RE " << (int)RDE.b8[LO] << " " <<
-				 std::hex << "RH " << (int)RHL.b8[HI] << " " <<
-				 std::hex << "RL " << (int)RHL.b8[LO] << " " << std::endl;
+// copy a drawn line into frame_buffer, marking the 8x8 tiles it changes and
+// hashing it again if it changed at all
+void GPU::update_line(uint8_t ly, const uint8_t* fresh) {
+	uint8_t* line = &frame_buffer[static_cast<size_t>(ly) * frame_width];
+	bool changed = false;
+	for (int tx = 0; tx < FRAME_TILES_X; tx++) {
+		if (std::memcmp(line + tx * 8, fresh + tx * 8, 8) == 0) continue;
+		frame_info.set_dirty((ly >> 3) * FRAME_TILES_X + tx);
+		changed = true;
+	}
+	if (!changed) return;
+	std::memcpy(line, fresh, frame_width);
+	line_hash[ly] = hash_line(ly);
 }
 
-GPU::GPU() {
-	frame_buffer= std::make_unique<uint8_t[]>(static_cast<size_t>(frame_height)*frame_width );
-	total_frame = std::make_unique<uint8_t[]>(256 * 256);
+static uint64_t hash_mix(uint64_t hash, uint64_t word) {
+	hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+	return hash ^ hash >> 29;
 }
 
-void GPU::set_memmap(Memory* mem) {
-	memory = mem;
+uint64_t GPU::hash_line(uint8_t ly) const {
+	const uint8_t* line = &frame_buffer[static_cast<size_t>(ly) * frame_width];
+	uint64_t hash = ly;
+	for (int x = 0; x < frame_width; x += 8) {
+		uint64_t word;
+		std::memcpy(&word, line + x, 8);
+		hash = hash_mix(hash, word);
+	}
+	return hash;
+}
+
+// the frame is complete: fold the line hashes and hand it to the consumer
+void GPU::finish_frame() {
+	uint64_t hash = 0;
+	for (uint64_t h : line_hash) hash = hash_mix(hash, h);
+	frame_info.hash = hash;
+	last_frame_info = frame_info;
+	frame_info = FrameInfo();
+	if (output_format == PIXEL_FORMAT::NONE) return;
+	output_frames.back_info() = last_frame_info;
+	output_frames.publish();
 }
 
-void GPU::draw_frame() {
-	auto display_enable = (memory->read(LCDC) >> 7) & 0x01;
-	if (!display_enable) return;
+// background, window and sprites of one line
+void GPU::compose_line(uint8_t ly, uint8_t lcdc, uint8_t* line) {
+	if (ly == 0) window_line = 0;
 
-	auto window_tilemap_select = (memory->read(LCDC) >> 6) & 0x01;
-	auto window_display = (memory->read(LCDC) >> 5) & 0x01;
-	auto tiledata_select= (memory->read(LCDC) >> 4) & 0x01;
-	auto bg_tilemap_select = (memory->read(LCDC) >> 3) & 0x01;
-	auto obj_size = (memory->read(LCDC) >> 2) & 0x01;
-	auto obj_display_enable = (memory->read(LCDC) >> 1) & 0x01;
-	auto bg_display = (memory->read(LCDC) >> 0) & 0x01;
+	auto window_tilemap_select = (lcdc >> 6) & 0x01;
+	auto window_display = (lcdc >> 5) & 0x01;
+	auto tiledata_select = (lcdc >> 4) & 0x01;
+	auto bg_tilemap_select = (lcdc >> 3) & 0x01;
+	auto obj_display_enable = (lcdc >> 1) & 0x01;
+	auto bg_display = (lcdc >> 0) & 0x01;
 
+	uint8_t colors[FRAME_WIDTH] = {};	//color numbers, sprite priority is decided on these
 	if (bg_display) {
-		auto bg_top_addr = 0x9800 + 0x400 * bg_tilemap_select;
-		auto tile_top_addr = 0x9000 - 0x1000 * tiledata_select;
-		for (int i = 0; i < 32; i++) {
-			for (int j = 0; j < 32; j++) {
-				auto tilenum = memory->read(bg_top_addr + i * 32 + j);
-				uint16_t tile_id;
-				if (!tiledata_select) tile_id = (int8_t)tilenum;
-				else tile_id = tilenum;
-				auto tile_addr = tile_top_addr + 16 * tile_id;
-				for (int k = 0; k < 8; k++) { //1 tile has 16 byte 8px * 8line 
-					uint8_t b1 = memory->read(tile_addr++);
-					uint8_t b2 = memory->read(tile_addr++);
-					for (int l = 0; l < 8; l++) {
-						auto px = ((b2 >> (7 - l)) & 0x01);
-						px += ((b1 >> (7 - l)) & 0x01)<<1;
-						auto y = 8 * i + k;
-						auto x = 8 * j + l;
-						total_frame[static_cast<size_t>(y) * 256 + x] = px;
-					}
-				}
-			}
-		}
+		const uint8_t y = ly + memory->read(LCD_SCROLL_Y);	//wraps around the 256x256 map
+		fetch_tiles(colors, 0, 0x9800 + 0x400 * bg_tilemap_select + (y >> 3) * 32, memory->read(LCD_SCROLL_X), y & 7, tiledata_select);
 	}
-	else {
-		std::memset(total_frame.get(), 0, 256*256);
+
+	const int window_x = memory->read(LCD_WINDOW_X) - 7;
+	if (window_display && ly >= memory->read(LCD_WINDOW_Y) && window_x < frame_width) {
+		const int from = std::max(window_x, 0);
+		fetch_tiles(colors, from, 0x9800 + 0x400 * window_tilemap_select + (window_line >> 3) * 32, static_cast<uint8_t>(from - window_x), window_line & 7, tiledata_select);
+		window_line++;
 	}
-	
-	auto scroll_y = memory->read(LCD_SCROLL_Y);
-	auto scroll_x = memory->read(LCD_SCROLL_X);
 
-	for (int y = 0; y < frame_height; y++) {
-		for (int x = 0; x < frame_width; x++) {
-			frame_buffer[static_cast<size_t>(y) * frame_width + x] = total_frame[(static_cast<size_t>(scroll_y) + y) * 256 + (static_cast<size_t>(scroll_x) + x)];
-		}
+	PixelOps::apply_palette(colors, memory->read(BG_PALETTE), line, frame_width);
+	if (obj_display_enable) draw_sprites(ly, lcdc, colors, line);
+}
+
+// OAM scan: the first 10 sprites covering line ly, in drawing priority.
+// smaller X wins, then the lower OAM entry
+uint8_t GPU::scan_sprites(uint8_t ly, uint8_t height, uint8_t* found) {
+	uint8_t count = 0;
+	for (uint8_t i = 0; i < SPRITE_NUM && count < SPRITES_PER_LINE; i++) {
+		const int top = memory->read(OAM_ADDR + i * 4) - 16;
+		if (ly < top || ly >= top + height) continue;
+		//insertion sort, stable so equal X keeps OAM order
+		uint8_t j = count++;
+		const uint8_t x = memory->read(OAM_ADDR + i * 4 + 1);
+		for (; j > 0 && memory->read(OAM_ADDR + found[j - 1] * 4 + 1) > x; j--) found[j] = found[j - 1];
+		found[j] = i;
 	}
+	return count;
+}
 
-	if (window_display) {
-		//draw window
-		auto window_top_addr = 0x9800 + 0x400 * window_tilemap_select;
-		auto tile_top_addr = 0x9000 - 0x1000 * tiledata_select;
-		for (int i = 0; i < 18; i++) {
-			for (int j = 0; j < 20; j++) {
-				auto tilenum = memory->read(window_top_addr + i * 32 + j);
-				uint16_t tile_id;
-				if (!tiledata_select) tile_id = (int8_t)tilenum;
-				else tile_id = tilenum;
-				auto tile_addr = tile_top_addr + 16 * tile_id;
-				for (int k = 0; k < 8; k++) { //1 tile has 16 byte 8px * 8line 
-					uint8_t b1 = memory->read(tile_addr++);
-					uint8_t b2 = memory->read(tile_addr++);
-					for (int l = 0; l < 8; l++) {
-						auto px = ((b2 >> (7 - l)) & 0x01);
-						px += ((b1 >> (7 - l)) & 0x01) << 1;
-						auto y = 8 * i + k;
-						auto x = 8 * j + l;
-						if(px!=0) frame_buffer[static_cast<size_t>(y) * 160 + x] = px;
-					}
-				}
-			}
+// visible rows of the sprites on line ly, composited over the line at once
+void GPU::draw_sprites(uint8_t ly, uint8_t lcdc, const uint8_t* colors, uint8_t* line) {
+	const uint8_t height = (lcdc >> 2 & 0x01) ? 16 : 8;
+	uint8_t found[SPRITES_PER_LINE];
+	const uint8_t count = scan_sprites(ly, height, found);
+	if (!count) return;
+
+	const uint8_t palettes[2] = { memory->read(OBJ_PALETTE0), memory->read(OBJ_PALETTE1) };
+	uint8_t sprites[FRAME_WIDTH] = {};	//sprite layer, the first sprite drawn on a pixel keeps it
+	for (uint8_t n = 0; n < count; n++) {
+		const uint16_t obj_addr = OAM_ADDR + found[n] * 4;
+		const int top = memory->read(obj_addr) - 16;
+		const int left = memory->read(obj_addr + 1) - 8;
+		uint8_t tile_id = memory->read(obj_addr + 2);
+		const uint8_t flags = memory->read(obj_addr + 3);
+		if (left <= -8 || left >= frame_width) continue;	//still counts towards the limit
+
+		const bool behind = flags >> 7 & 0x01;
+		const bool x_flip = flags >> 6 & 0x01;
+		const bool y_flip = flags >> 5 & 0x01;
+		const uint8_t palette = palettes[flags >> 4 & 0x01];
+		uint8_t y = static_cast<uint8_t>(ly - top);
+		if (y_flip) y = height - 1 - y;
+		if (height == 16) tile_id = (tile_id & 0xFE) + (y >> 3);
+
+		const uint8_t* row = tile_row(tile_id, y & 7, x_flip);
+		const int from = std::max(left, 0);
+		const int to = std::min(left + 8, static_cast<int>(frame_width));
+		for (int x = from; x < to; x++) {
+			const uint8_t px = row[x - left];
+			if (px == 0 || sprites[x]) continue;
+			sprites[x] = PIXEL_OBJ_OPAQUE | (behind ? PIXEL_OBJ_BEHIND : 0) | (palette >> (px * 2) & 0x03);
 		}
 	}
-	
-	if (obj_display_enable) {
-		//draw obj
-		auto obj_top_addr = 0xFE00;
-		auto obj_addr = obj_top_addr;
-		auto tile_top_addr = 0x8000;
-		for (int i = 0; i < 40; i++) {//40 objects 
-			int16_t top = memory->read(obj_addr++) - 16;
-			int16_t left= memory->read(obj_addr++) - 8;
-			auto tile_id = memory->read(obj_addr++);
-			auto flags = memory->read(obj_addr++);
-			auto tile_addr = tile_top_addr + 16 * tile_id;
-
-			auto priority = flags >> 7 & 0x01;
-			auto x_flip   = flags >> 6 & 0x01;
-			auto y_flip   = flags >> 5 & 0x01;
-			auto palette  = flags >> 4 & 0x01;
-			
-			for (int16_t k = 0; k < 8; k++) { //1 tile has 16 byte 8px * 8line 
-				uint8_t b1 = memory->read(tile_addr++);
-				uint8_t b2 = memory->read(tile_addr++);
-				for (int16_t l = 0; l < 8; l++) {
-					auto px = ((b2 >> (7 - l)) & 0x01);
-					px += ((b1 >> (7 - l)) & 0x01) << 1;
-					int16_t x = left + l;
-					int16_t y = top + k;
-					int32_t index = (int32_t)frame_width * y + x;
-					if (index < 0)continue;
-					if (index > 160*144 )continue;
-					if (px != 0 && !priority) 
-						frame_buffer[index] = px;
-					else if (priority && !frame_buffer[index]) {
-						frame_buffer[index] = px;
-					}
-				}
-			}
-		}
-	}	
+	PixelOps::composite(line, colors, sprites, frame_width);
 }
 
-Memory::Memory(Cartridge& cart, uint8_t* rom, size_t rom_size, uint8_t* bootrom)
-	: memory_bank_size(cart.rom_size_banknum),
-	map(MAX_ADDRESS, 0),
-	boot_rom(BOOTROM_SIZE,0)
+Memory::Memory(Cartridge& cart, std::shared_ptr<const RomImage> rom, uint8_t* bootrom, const std::string& save_path)
+	: map(MAX_ADDRESS, 0),
+	boot_rom(BOOTROM_SIZE,0),
+	rom(rom),
+	rom_bank_count(static_cast<uint16_t>(std::min<size_t>(cart.rom_size_banknum, rom->bank_count())))
 {
+	if (cart.ram_size()) cart_ram = std::make_unique<SaveRam>(cart.ram_size(), cart.has_battery() ? save_path : "");
 
 	for (size_t i = 0;i < BOOTROM_SIZE; i++)
 		boot_rom[i] = bootrom[i];
-	for (size_t i = 0;i < CART_MAX_ADDR; i++)
-		map[i] = rom[i];
+	select_mapper(cart.cartridge_type);
+
+	// page table: RAM is read and written directly, ROM (straight from the
+	// shared image) and external RAM pages follow the mapper. MBC control
+	// and the I/O page take the slow path, as do VRAM and OAM writes so the
+	// renderer can tell which tiles, map rows and sprites changed
+	for (int page = 0x80; page < PAGE_NUM; page++) {
+		write_pages[page] = ram_page(page);
+		if ((page < 0xA0 || page >= 0xC0) && page != 0xFF) read_pages[page] = &map[page << PAGE_SHIFT];
+	}
+	map_rom_bank();
+	map_ram_bank();
+}
 
-	rom_banks.resize(cart.rom_size_banknum);
+// host memory behind a directly writable page, nullptr for pages with side
+// effects or tracked writes (VRAM and OAM)
+uint8_t* Memory::ram_page(uint8_t page) {
+	if (page < 0xC0 || page == 0xFE || page == 0xFF) return nullptr;
+	return &map[page << PAGE_SHIFT];
+}
 
-	// allocate and copy rom banks
-	for (int i = 0;i < cart.rom_size_banknum;i++) {
-		rom_banks[i] = std::make_unique<uint8_t[]>(0x4000);
-		std::memcpy(rom_banks[i].get(), rom + i*0x4000, 0x4000);
+// point both ROM windows at the selected banks
+void Memory::map_rom_bank() {
+	const uint8_t* bank0 = rom->data() + (rom_bank0 % rom_bank_count) * 0x4000;
+	const uint8_t* bank = rom->data() + (rom_bank % rom_bank_count) * 0x4000;
+	for (int page = 0; page < 0x40; page++) {
+		read_pages[page] = bank0 + (page << PAGE_SHIFT);
+		read_pages[page + 0x40] = bank + (page << PAGE_SHIFT);
 	}
+	if (is_booting) read_pages[0] = &boot_rom[0];	//boot ROM overlays the first page
+	code_generation++;
 }
 
-void Memory::dma_operation(uint8_t src) {
-	uint16_t src_addr = src << 8;	//copy from 0x**00 ~ 0x**9F
-	uint16_t dst_addr = 0xFE00;		//copy to   0xFE00 ~ 0xFE9F
-	std::memcpy(&map[0] + dst_addr, &map[0] + src_addr, 0x9F);
+// offset of an external RAM address in the selected bank
+size_t Memory::cart_ram_offset(uint16_t address) const {
+	return (ram_bank * 0x2000 + (address - 0xA000)) % cart_ram->size();
 }
 
-void Memory::write(const uint16_t address, uint8_t data) {
+// point 0xA000-0xBFFF at the selected RAM bank. disabled RAM and the MBC3
+// clock registers take the slow path, and so do writes to battery RAM so
+// they can mark the save file dirty
+void Memory::map_ram_bank() {
+	const bool mapped = ram_enabled && cart_ram && ram_bank < 0x08;
+	for (int page = 0; page < 0x20; page++) {
+		uint8_t* p = mapped ? cart_ram->data() + cart_ram_offset(0xA000 + (page << PAGE_SHIFT)) : nullptr;
+		read_pages[page + 0xA0] = p;
+		write_pages[page + 0xA0] = mapped && cart_ram->persistent() ? nullptr : p;
+	}
+}
 
-	if (memory_bank_size && address >= 0x2000 && address < 0x4000) {
-		std::cout << "switch bank : "<<  address << " " << static_cast<int>(data) << std::endl;
-		if(memory_bank_size > data)
-			memory_bank = data;
-		return;
+void Memory::finish_boot() {
+	is_booting = false;
+	map_rom_bank();
+}
+
+void Memory::set_scheduler(Scheduler* sched) {
+	scheduler = sched;
+	scheduler->set_callback(EVENTS::TIMER, [this](uint64_t at) { timer_event(at); });
+	scheduler->set_callback(EVENTS::OAM_DMA, [this](uint64_t at) { dma_event(at); });
+}
+
+// T-cycles per TIMA increment, selected by TAC bits 0-1
+uint32_t Memory::timer_period() const {
+	static const uint32_t periods[] = {
+		CLOCK_FREQUENCY / 4096, CLOCK_FREQUENCY / 262144, CLOCK_FREQUENCY / 65536, CLOCK_FREQUENCY / 16384
+	};
+	return periods[map[TIMER_CONTROL] & 0x03];
+}
+
+uint8_t Memory::timer_counter() const {
+	if (!(map[TIMER_CONTROL] & 0x04)) return map[TIMER_COUNTER];
+	return static_cast<uint8_t>(timer_start_value + (scheduler->now - timer_start) / timer_period());
+}
+
+// TIMA counts up from counter now, schedule its overflow
+void Memory::restart_timer(uint8_t counter) {
+	timer_start = scheduler->now;
+	timer_start_value = counter;
+	scheduler->schedule(EVENTS::TIMER, timer_start + (0x100 - counter) * timer_period());
+}
+
+// TIMA overflowed: reload from TMA and request the timer interrupt
+void Memory::timer_event(uint64_t at) {
+	timer_start = at;
+	timer_start_value = map[TIMER_MODULO];
+	scheduler->schedule(EVENTS::TIMER, at + (0x100 - timer_start_value) * timer_period());
+	write(INTERRUPT_FLAG, map[INTERRUPT_FLAG] | 1 << static_cast<uint8_t>(INTERRUPTS::TIMER));
+}
+
+// VRAM and OAM write, stamps the tile, map row or sprite it changed
+void Memory::write_video(uint16_t address, uint8_t data) {
+	if (map[address] == data) return;
+	map[address] = data;
+	video_generation++;
+	if (address < TILE_DATA_END) tile_generation[(address - VRAM_ADDR) >> 4] = video_generation;
+	else if (address < VRAM_END) map_row_generation[(address - TILE_MAP0_ADDR) >> 5] = video_generation;
+	else if (address < OAM_END) oam_generation[(address - OAM_ADDR) >> 2] = video_generation;
+}
+
+// start a transfer from 0x**00-0x**9F, restarting one in flight
+void Memory::dma_operation(uint8_t src) {
+	dma_source = src;
+	scheduler->schedule(EVENTS::OAM_DMA, scheduler->now + OAM_DMA_CYCLES);
+}
+
+// the whole source fits in one page, so a mapped source (RAM or banked ROM)
+// is a single copy; only unmapped pages go through read()
+void Memory::dma_event(uint64_t at) {
+	uint8_t bytes[OAM_END - OAM_ADDR];
+	const uint8_t* src = read_pages[dma_source];
+	if (!src) {
+		for (uint16_t i = 0; i < sizeof(bytes); i++) bytes[i] = read(dma_source << 8 | i);
+		src = bytes;
 	}
+	uint8_t* oam = &map[OAM_ADDR];
+	if (std::memcmp(oam, src, sizeof(bytes)) == 0) return;
+	video_generation++;
+	for (int sprite = 0; sprite < SPRITE_NUM; sprite++) {
+		if (std::memcmp(oam + sprite * 4, src + sprite * 4, 4) == 0) continue;
+		oam_generation[sprite] = video_generation;
+	}
+	std::memcpy(oam, src, sizeof(bytes));
+}
 
-	if (address >= 0 && address < 0x8000) {
-		std::cout << "unable to write ROM\n";
+void Memory::write_slow(const uint16_t address, uint8_t data) {
+
+	//video memory
+	if ((address >= VRAM_ADDR && address < VRAM_END) || (address >= OAM_ADDR && address < OAM_END)) {
+		write_video(address, data);
 		return;
 	}
 
-	if (address >= 0x2000 && address < 0x4000) {
-		std::cout << "switch bank\n";
+	//mapper control
+	if (address < 0x8000) {
+		(this->*mbc_write)(address, data);
 		return;
 	}
 
+	//external RAM: battery RAM, disabled or missing RAM, or a clock register
 	if (address >= 0xA000 && address < 0xC000) {
-		std::cout << ">>>External rom<<<\n";
+		if (read_pages[address >> PAGE_SHIFT]) {
+			size_t offset = cart_ram_offset(address);
+			cart_ram->data()[offset] = data;
+			cart_ram->mark_dirty(offset);
+		}
+		else if (ram_enabled && ram_bank >= 0x08 && ram_bank <= 0x0C) rtc[ram_bank - 0x08] = data;
+		else GB_LOG(MBC, TRACE, "write to disabled external ram");
 		return;
 	}
 
@@ -1675,6 +455,24 @@ void Memory::write(const uint16_t address, uint8_t data) {
 		else if (data & 0x20) data = 0x0F & (key>>4);
 	}
 
+	//DIV resets on any write
+	if (address == DIV_REGISTER) {
+		data = 0;
+		div_start = scheduler->now;
+	}
+
+	//timer
+	if (address == TIMER_COUNTER && (map[TIMER_CONTROL] & 0x04)) {
+		restart_timer(data);
+	}
+	if (address == TIMER_CONTROL) {
+		uint8_t counter = timer_counter();
+		map[TIMER_CONTROL] = data;
+		map[TIMER_COUNTER] = counter;
+		if (data & 0x04) restart_timer(counter);
+		else scheduler->cancel(EVENTS::TIMER);
+	}
+
 	//DMA operation
 	if (address == DMA_OP_ADDRESS) {
 		dma_operation(data);
@@ -1682,24 +480,40 @@ void Memory::write(const uint16_t address, uint8_t data) {
 
 	//Default operation
 	map[(const uint16_t)address] = data;
+
+	if (address == INTERRUPT_FLAG || address == INTERRUPT_ENABLE) {
+		interrupt_pending = map[INTERRUPT_FLAG] & map[INTERRUPT_ENABLE] & 0x1F;
+	}
+
+	if (code_chunks[address >> CODE_CHUNK_SHIFT]) invalidate_code(address);
 }
 
-uint8_t Memory::read(uint16_t address) {
+// writes to code pages take the slow path until the page is invalidated
+void Memory::mark_code(uint16_t address) {
+	code_chunks[address >> CODE_CHUNK_SHIFT] = 1;
+	write_pages[address >> PAGE_SHIFT] = nullptr;
+}
 
-	// access to rom cartridge
-	if (memory_bank_size && address >= 0x4000 && address < 0x8000) {
-		return rom_banks[memory_bank][address - 0x4000];
-	}
+// drop decoded blocks of a RAM chunk after it has been written
+void Memory::invalidate_code(uint16_t address) {
+	code_chunks[address >> CODE_CHUNK_SHIFT] = 0;
+	code_chunk_generation[address >> CODE_CHUNK_SHIFT]++;
+	code_generation++;
+	write_pages[address >> PAGE_SHIFT] = ram_page(address >> PAGE_SHIFT);
+}
 
+// external RAM and I/O
+uint8_t Memory::read_slow(uint16_t address) {
 
 	if (address >= 0xA000 && address < 0xC000) {
-		std::cout << ">>>External ram<<<\n";
+		if (ram_enabled && ram_bank >= 0x08 && ram_bank <= 0x0C) return rtc[ram_bank - 0x08];
+		GB_LOG(MBC, TRACE, "read from disabled external ram");
+		return 0xFF;
 	}
 
-	if (is_booting && address < BOOTROM_SIZE ) {
-		//booting. read from boot rom
-		return boot_rom[address];
-	}
+	if (address == DIV_REGISTER) return static_cast<uint8_t>((scheduler->now - div_start) / DIV_PERIOD);
+	if (address == TIMER_COUNTER) return timer_counter();
+
 	//Default read
 	return map[address];
 }
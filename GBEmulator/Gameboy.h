@@ -2,9 +2,20 @@
 #include <iostream>
 #include <memory>
 #include "Cartridge.h"
+#include "Scheduler.h"
+#include "Log.h"
+#include "Profiler.h"
+#include "RomImage.h"
+#include "SaveRam.h"
+#include "PixelOps.h"
+#include "FrameExchange.h"
 #include <vector>
+#include <deque>
 
 #define VBLANK_INTR_ADDR    (0x0040)
+#define LCD_STAT_INTR_ADDR  (0x0048)
+#define TIMER_INTR_ADDR     (0x0050)
+#define SERIAL_INTR_ADDR    (0x0058)
 #define KEYPAD_INTR_ADDR    (0x0060)
 #define ROM_TITLE_START		(0x0134)
 #define ROM_TITLE_END		(0x0143)
@@ -22,6 +33,9 @@
 #define GLOBAL_CHECKSUM_ADDR	(0x014E)
 #define CART_MAX_ADDR		(0x8000)
 #define DIV_REGISTER		(0xFF04)
+#define TIMER_COUNTER		(0xFF05)
+#define TIMER_MODULO		(0xFF06)
+#define TIMER_CONTROL		(0xFF07)
 #define KEY_INPUT_ADDRES	(0xFF00)
 #define INTERRUPT_FLAG		(0xFF0F)
 #define LCDC			    (0xFF40)
@@ -29,22 +43,49 @@
 #define LCD_SCROLL_Y        (0xFF42)
 #define LCD_SCROLL_X        (0xFF43)
 #define DMA_OP_ADDRESS		(0xFF46)
+#define BG_PALETTE			(0xFF47)
+#define OBJ_PALETTE0		(0xFF48)
+#define OBJ_PALETTE1		(0xFF49)
+#define LCD_WINDOW_Y		(0xFF4A)
+#define LCD_WINDOW_X		(0xFF4B)
+#define OAM_DMA_CYCLES		(640)	//160 bytes, one per machine cycle
 #define INTERRUPT_ENABLE	(0xFFFF)
 #define MAX_ADDRESS			(0x10000)
 
 #define BOOTROM_SIZE		(0x100)
 
+#define PAGE_SHIFT			(8)
+#define PAGE_NUM			(MAX_ADDRESS >> PAGE_SHIFT)
+#define CODE_CHUNK_SHIFT	(PAGE_SHIFT)	//RAM code is tracked per page
+#define BLOCK_MAX_OPS		(32)
+
+#define VRAM_ADDR			(0x8000)
+#define VRAM_END			(0xA000)
+#define TILE_DATA_END		(0x9800)
+#define TILE_MAP0_ADDR		(0x9800)
+#define TILE_MAP1_ADDR		(0x9C00)
+#define OAM_ADDR			(0xFE00)
+#define OAM_END				(0xFEA0)
+#define TILE_NUM			(384)
+#define TILE_MAP_ROWS		(32)
+#define SPRITE_NUM			(40)
+#define SPRITES_PER_LINE	(10)
+
 #define LCD_VERT_LINES		(154)
 #define LCD_LINE_CYCLES     (456)
+#define LCD_FRAME_CYCLES    (LCD_VERT_LINES * LCD_LINE_CYCLES)
 
 #define HI (1)
 #define LO (0)
 
 #define FRAME_WIDTH  (160)
 #define FRAME_HEIGHT (144)
+#define FRAME_TILES_X (FRAME_WIDTH / 8)
+#define FRAME_TILES_Y (FRAME_HEIGHT / 8)
 
 #define CLOCK_FREQUENCY (4000000)
 #define DIV_COUNTER_INCREMENT_FREQUENCY (16384)
+#define DIV_PERIOD (CLOCK_FREQUENCY / DIV_COUNTER_INCREMENT_FREQUENCY)
 
 typedef union registor {
 	uint16_t b16;
@@ -59,6 +100,13 @@ enum class INTERRUPTS{
 	KEYPAD
 };
 
+enum class RUN_STATUS {
+	FRAME_READY,
+	CYCLES_DONE,
+	BREAKPOINT,
+	ERROR
+};
+
 enum class KEYS {
 	BUTTON_A,
 	BUTTON_B,
@@ -80,23 +128,151 @@ private:
 	//uint8_t boot_rom[BOOTROM_SIZE];
 	std::vector<uint8_t> boot_rom;
 
+	//OAM DMA, the 160 bytes land in OAM at the end of the transfer
+	uint8_t dma_source = 0;
 	void dma_operation(uint8_t src);
-	uint8_t memory_bank = 0;
-	std::vector<std::unique_ptr<uint8_t[]> > rom_banks = {};
-	const uint8_t memory_bank_size = 0;
+	void dma_event(uint64_t at);
+	std::shared_ptr<const RomImage> rom;
+	const uint16_t rom_bank_count = 0;
+	//cartridge mapper, the policy is picked from cartridge_type
+	struct MBC_NONE;
+	struct MBC1;
+	struct MBC3;
+	struct MBC5;
+	typedef void (Memory::*MBC_WRITE)(uint16_t address, uint8_t data);
+	MBC_WRITE mbc_write = nullptr;
+	template<class MBC> void write_mbc(uint16_t address, uint8_t data);
+	void select_mapper(uint8_t cartridge_type);
+	uint16_t rom_bank = 1;		//mapped at 0x4000-0x7FFF
+	uint16_t rom_bank0 = 0;		//mapped at 0x0000-0x3FFF
+	uint8_t ram_bank = 0;
+	bool ram_enabled = false;
+	uint8_t bank_low = 1;		//raw mapper registers
+	uint8_t bank_high = 0;
+	uint8_t bank_mode = 0;
+	uint8_t rtc[5] = {};		//MBC3 clock registers, selected as RAM banks 0x08-0x0C
+	std::unique_ptr<SaveRam> cart_ram;	//nullptr when the cartridge has no RAM
+	//RAM chunks holding decoded code
+	std::vector<uint8_t> code_chunks = std::vector<uint8_t>(MAX_ADDRESS >> CODE_CHUNK_SHIFT, 0);
+	std::vector<uint32_t> code_chunk_generation = std::vector<uint32_t>(MAX_ADDRESS >> CODE_CHUNK_SHIFT, 0);
+	void invalidate_code(uint16_t address);
+	//page table, nullptr sends the access to the slow path
+	const uint8_t* read_pages[PAGE_NUM] = {};
+	uint8_t* write_pages[PAGE_NUM] = {};
+	uint8_t* ram_page(uint8_t page);
+	void map_rom_bank();
+	void map_ram_bank();
+	size_t cart_ram_offset(uint16_t address) const;
+	uint8_t read_slow(uint16_t address);
+	void write_slow(uint16_t address, uint8_t data);
+	//video memory changes, each entry holds the video_generation of its last change
+	uint32_t video_generation = 0;
+	std::vector<uint32_t> tile_generation = std::vector<uint32_t>(TILE_NUM, 0);
+	std::vector<uint32_t> map_row_generation = std::vector<uint32_t>(2 * TILE_MAP_ROWS, 0);
+	std::vector<uint32_t> oam_generation = std::vector<uint32_t>(SPRITE_NUM, 0);
+	void write_video(uint16_t address, uint8_t data);
+	//DIV and timer, both derived from the clock (TIMA only while the timer runs)
+	Scheduler* scheduler = nullptr;
+	uint64_t div_start = 0;
+	uint64_t timer_start = 0;
+	uint8_t timer_start_value = 0;
+	uint32_t timer_period() const;
+	uint8_t timer_counter() const;
+	void restart_timer(uint8_t counter);
+	void timer_event(uint64_t at);
 public:
-	Memory(Cartridge &cart, uint8_t* rom, size_t rom_size,  uint8_t* bootrom);
+	Memory(Cartridge &cart, std::shared_ptr<const RomImage> rom, uint8_t* bootrom, const std::string& save_path);
+	void set_scheduler(Scheduler* sched);
 	uint8_t key = 0xFF;
-	void write(uint16_t address, uint8_t data);
-	uint8_t read(uint16_t address);
+	void write(uint16_t address, uint8_t data) {
+		uint8_t* page = write_pages[address >> PAGE_SHIFT];
+		if (page) page[address & 0xFF] = data;
+		else write_slow(address, data);
+	}
+	uint8_t read(uint16_t address) {
+		const uint8_t* page = read_pages[address >> PAGE_SHIFT];
+		if (page) return page[address & 0xFF];
+		return read_slow(address);
+	}
+	uint16_t read16(uint16_t address) {
+		const uint8_t* page = read_pages[address >> PAGE_SHIFT];
+		if (page && (address & 0xFF) != 0xFF) return page[address & 0xFF] | page[(address & 0xFF) + 1] << 8;
+		return read(address) | read(address + 1) << 8;
+	}
 	bool is_booting = true;
+	void finish_boot();
+	uint16_t get_memory_bank() const { return rom_bank % rom_bank_count; }
+	uint16_t get_rom_bank0() const { return rom_bank0 % rom_bank_count; }
+	void mark_code(uint16_t address);
+	uint32_t get_code_generation(uint16_t address) const { return code_chunk_generation[address >> CODE_CHUNK_SHIFT]; }
+	uint32_t code_generation = 0;	//changes on bank switch and writes to decoded code
+	uint8_t interrupt_pending = 0;	//IF & IE, refreshed on writes to either register
+	//video memory change tracking. an entry changed since a renderer last
+	//looked if its generation is above the video generation seen back then
+	uint32_t get_video_generation() const { return video_generation; }
+	uint32_t get_tile_generation(uint16_t tile) const { return tile_generation[tile]; }
+	uint32_t get_map_row_generation(uint8_t tile_map, uint8_t row) const { return map_row_generation[tile_map * TILE_MAP_ROWS + row]; }
+	uint32_t get_oam_generation(uint8_t sprite) const { return oam_generation[sprite]; }
 };
 
+class GPU;
+
 class CPU
 {
 private:
+	typedef void (CPU::*OP_HANDLER)();
+	struct DecodedOp {
+		OP_HANDLER handler;
+		uint8_t op;
+		uint8_t length;
+		uint8_t imm[2];
+	};
+	struct Block {
+		uint16_t pc;
+		uint8_t count;
+		uint32_t generation;
+		DecodedOp ops[BLOCK_MAX_OPS];
+	};
+	static const OP_HANDLER OP_TABLE[0x100];
+	static const OP_HANDLER CB_TABLE[0x100];
+	template<uint8_t OP> void op();
+	template<uint8_t OP> void cb_op();
+	template<uint8_t R> uint8_t cb_load();
+	template<uint8_t R> void cb_store(uint8_t val);
+	void execute(uint8_t op);
+	void begin_instruction();
+	void service_interrupts();
+	void lcd_line_event(uint64_t at);
+	void wait_for_interrupt();
+	void end_instruction(uint8_t op);
+	bool hit_breakpoint();
+	void run_dispatch();
+	void run_blocks();
+	Block* find_block();
+	void decode_block(Block& block, uint16_t pc);
+	void run_block(const Block& block);
+	uint8_t fetch8();
+	uint16_t fetch16();
 	void shift_operation_CB();
+	uint8_t flag_z();
+	uint8_t flag_n();
+	uint8_t flag_h();
+	uint8_t flag_c();
+	void check_flag(uint8_t lazy, uint8_t eager, const char* name);
+	void set_flags_add(uint8_t a, uint8_t b, uint16_t res);
+	void set_flags_sub(uint8_t a, uint8_t b, uint16_t res);
+	void set_flags_inc(uint8_t res);
+	void set_flags_dec(uint8_t res);
+	void set_flags_logic(uint8_t res, uint8_t h);
+	void set_flags(uint8_t z, uint8_t n, uint8_t h, uint8_t c);
+	void set_flag_z(uint8_t z);
+	void set_flags_nh(uint8_t n, uint8_t h);
 	Memory* memory = nullptr;
+	Scheduler* scheduler = nullptr;
+	Profiler* profiler = nullptr;
+	GPU* gpu = nullptr;
+	uint16_t profile_pc = 0;
+	uint16_t profile_bank = 0;
 	//general registors
 	uint8_t RA = 0;
 	reg RBC = { 0 };
@@ -109,19 +285,41 @@ private:
 	uint8_t FH = { 0 };
 	uint8_t FN = { 0 };
 	uint8_t FC = { 0 };
+	//lazy flags: Z is set when zres is 0, N and H are derived from nh_*
+	uint8_t zres = { 1 };
+	uint8_t nh_op = { 0 };
+	uint8_t nh_a = { 0 };
+	uint8_t nh_b = { 0 };
+	uint8_t nh_res = { 0 };
 	//interrupts
 	uint8_t IME = { 0 };
 	uint8_t HALT = { 0 };
-	uint64_t cycle_count = 0;
-	uint32_t lcd_count = 0;
-	uint32_t div_count = 0;
+	uint64_t instruction_count = 0;
+	uint64_t run_end = 0;
+	//breakpoints
+	std::vector<bool> breakpoints = std::vector<bool>(MAX_ADDRESS, false);
+	uint32_t breakpoint_count = 0;
+	bool at_breakpoint = false;
+	//pre-decoded basic blocks, indexed by region (bank 0, switchable banks, RAM) and PC
+	std::deque<Block> blocks;
+	std::vector<std::vector<uint32_t> > block_index;
+	const uint8_t* imm = nullptr;
 public:
 	void set_memmap(Memory* mem);
+	void set_scheduler(Scheduler* sched);
+	void set_profiler(Profiler* prof);
+	void set_gpu(GPU* g);
 	void step();
+	RUN_STATUS run(uint64_t cycles);
 	void set_interrupt_flag(INTERRUPTS intrpt);
+	void set_breakpoint(uint16_t address);
+	void clear_breakpoint(uint16_t address);
+	uint64_t get_cycle_count() const { return scheduler->now; }
+	uint64_t get_instruction_count() const { return instruction_count; }
 	void dump_reg(void);
 	bool ready_for_render = false;
-	
+	bool error = false;
+
 };
 
 class GPU {
@@ -129,25 +327,60 @@ private:
 	Memory* memory=nullptr;
 	uint8_t frame_width = FRAME_WIDTH;
 	uint8_t frame_height = FRAME_HEIGHT;
-	std::unique_ptr<uint8_t[]> total_frame = nullptr;
+	uint8_t window_line = 0;	//window rows drawn so far this frame
+	//VRAM tiles decoded to one color number per byte, plus x-flipped copies.
+	//a tile is decoded again when its generation in Memory moves on
+	std::vector<uint8_t> tile_cache = std::vector<uint8_t>(2 * TILE_NUM * 64, 0);
+	std::vector<uint32_t> tile_cache_generation = std::vector<uint32_t>(TILE_NUM, 0);
+	const uint8_t* tile_row(uint16_t tile, uint8_t y, bool x_flip);
+	void fetch_tiles(uint8_t* colors, int from, uint16_t map_row, uint8_t map_x, uint8_t tile_y, bool unsigned_ids);
+	uint8_t scan_sprites(uint8_t ly, uint8_t height, uint8_t* found);
+	void draw_sprites(uint8_t ly, uint8_t lcdc, const uint8_t* colors, uint8_t* line);
+	void compose_line(uint8_t ly, uint8_t lcdc, uint8_t* line);
+	//changes against the previous frame, compared a line at a time
+	FrameInfo frame_info;		//frame being drawn
+	FrameInfo last_frame_info;	//frame completed at line 143
+	std::vector<uint64_t> line_hash = std::vector<uint64_t>(FRAME_HEIGHT, 0);
+	void update_line(uint8_t ly, const uint8_t* fresh);
+	uint64_t hash_line(uint8_t ly) const;
+	void finish_frame();
+	//optional packed output, handed over a frame at a time. palettes are
+	//already applied in frame_buffer, so the LUT maps the 4 shades and only
+	//changes with the shade colors
+	PIXEL_FORMAT output_format = PIXEL_FORMAT::NONE;
+	FrameExchange output_frames;
+	uint8_t shade_rgb[4][3] = { {255, 255, 255}, {191, 191, 191}, {127, 127, 127}, {63, 63, 63} };
+	uint32_t rgba_lut[4] = {};
+	uint16_t rgb565_lut[4] = {};
+	void update_lut();
+	void write_output(uint8_t ly);
 public:
 	GPU();
 	void set_memmap(Memory* memory);
-	void draw_frame();
-	std::unique_ptr<uint8_t[]> frame_buffer = nullptr;
+	void draw_line(uint8_t ly);
+	std::unique_ptr<uint8_t[]> frame_buffer = nullptr;	//shade 0-3 per pixel, 0 is the lightest
+	void set_output(PIXEL_FORMAT format);
+	void set_shade_color(uint8_t shade, uint8_t r, uint8_t g, uint8_t b);
+	PIXEL_FORMAT get_output_format() const { return output_format; }
+	// finished frames in the output format, published at the end of line 143.
+	// one consumer may read them from any thread
+	FrameExchange& frames() { return output_frames; }
+	// dirty 8x8 tiles and hash of the last completed frame
+	const FrameInfo& frame_changes() const { return last_frame_info; }
 };
 
 class Gameboy
 {
 private:
 	Cartridge cartridge;
+	Scheduler scheduler;
 	std::unique_ptr<Memory> memory;
-	uint8_t* rom_ptr = nullptr;
-	size_t rom_size = 0; 
+	std::shared_ptr<const RomImage> rom;
 	bool key_pressed[static_cast<int>(KEYS::KEY_NUMS)] = {0};
 
 public:
-	Gameboy(uint8_t* rom, size_t size, uint8_t* boot_rom);
+	// save_path: .sav file backing battery RAM, empty to keep it in memory only
+	Gameboy(std::shared_ptr<const RomImage> rom, uint8_t* boot_rom, const std::string& save_path = "");
 	CPU cpu;
 	GPU gpu;
 	void show_title();
@@ -155,5 +388,7 @@ public:
 	bool isRendered = false;
 	void press(KEYS key);
 	void release(KEYS key);
+	RUN_STATUS run_frame();
+	RUN_STATUS run_cycles(uint64_t cycles);
 };
 
@@ -0,0 +1,134 @@
+#include "Log.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+static const char* const CATEGORY_NAMES[] = { "cpu", "interrupt", "memory", "mbc", "input", "system" };
+static const char* const LEVEL_NAMES[] = { "error", "warn", "info", "trace" };
+
+// Bounded multi-producer single-consumer ring (Vyukov). Each slot carries a
+// sequence number: pos when free for the producer claiming pos, pos + 1 once
+// the message is written and ready for the consumer.
+struct LogSlot {
+	std::atomic<uint64_t> seq;
+	LOG_CATEGORY category;
+	LOG_LEVEL level;
+	char text[LOG_MESSAGE_SIZE];
+};
+
+class LogRing
+{
+public:
+	LogRing() {
+		for (uint64_t i = 0; i < LOG_RING_SIZE; i++) slots[i].seq.store(i, std::memory_order_relaxed);
+	}
+	~LogRing() {
+		if (!writer.joinable()) return;
+		running.store(false);
+		writer.join();
+	}
+
+	void push(LOG_CATEGORY category, LOG_LEVEL level, const std::string& message) {
+		std::call_once(started, [this] { writer = std::thread(&LogRing::drain, this); });
+
+		uint64_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		LogSlot* slot;
+		for (;;) {
+			slot = &slots[pos & (LOG_RING_SIZE - 1)];
+			int64_t diff = static_cast<int64_t>(slot->seq.load(std::memory_order_acquire) - pos);
+			if (diff == 0) {
+				if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+			}
+			else if (diff < 0) {
+				//full, never block the emulation
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			else {
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+		slot->category = category;
+		slot->level = level;
+		size_t len = message.size() < LOG_MESSAGE_SIZE - 1 ? message.size() : LOG_MESSAGE_SIZE - 1;
+		std::memcpy(slot->text, message.data(), len);
+		slot->text[len] = '\0';
+		slot->seq.store(pos + 1, std::memory_order_release);
+	}
+
+	void flush() {
+		if (!writer.joinable()) return;
+		uint64_t target = enqueue_pos.load(std::memory_order_acquire);
+		while (written.load(std::memory_order_acquire) < target) std::this_thread::yield();
+	}
+
+private:
+	LogSlot slots[LOG_RING_SIZE];
+	std::atomic<uint64_t> enqueue_pos = { 0 };
+	std::atomic<uint64_t> written = { 0 };
+	std::atomic<uint64_t> dropped = { 0 };
+	std::atomic<bool> running = { true };
+	std::once_flag started;
+	std::thread writer;
+
+	bool pop() {
+		const uint64_t pos = written.load(std::memory_order_relaxed);
+		LogSlot& slot = slots[pos & (LOG_RING_SIZE - 1)];
+		if (slot.seq.load(std::memory_order_acquire) != pos + 1) return false;
+		std::cout << "[" << CATEGORY_NAMES[static_cast<int>(slot.category)] << "] ";
+		if (slot.level != LOG_LEVEL::TRACE) std::cout << LEVEL_NAMES[static_cast<int>(slot.level)] << ": ";
+		std::cout << slot.text << "\n";
+		slot.seq.store(pos + LOG_RING_SIZE, std::memory_order_release);
+		written.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	void drain() {
+		for (;;) {
+			bool busy = false;
+			while (pop()) busy = true;
+			uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+			if (lost) std::cout << "[log] " << lost << " messages dropped\n";
+			if (busy || lost) std::cout.flush();
+			else if (!running.load()) break;
+			else std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+};
+
+static LogRing ring;
+
+void Log::set_level(LOG_CATEGORY category, LOG_LEVEL level) {
+	levels[static_cast<int>(category)] = static_cast<uint8_t>(level);
+}
+
+bool Log::enable(const char* list) {
+	std::string names(list);
+	size_t start = 0;
+	while (start <= names.size()) {
+		size_t end = names.find(',', start);
+		if (end == std::string::npos) end = names.size();
+		std::string name = names.substr(start, end - start);
+		bool found = false;
+		for (int i = 0; i < static_cast<int>(LOG_CATEGORY::LOG_CATEGORY_NUMS); i++) {
+			if (name == "all" || name == CATEGORY_NAMES[i]) {
+				set_level(static_cast<LOG_CATEGORY>(i), LOG_LEVEL::TRACE);
+				found = true;
+			}
+		}
+		if (!found) return false;
+		start = end + 1;
+	}
+	return true;
+}
+
+void Log::write(LOG_CATEGORY category, LOG_LEVEL level, const std::string& message) {
+	ring.push(category, level, message);
+}
+
+void Log::flush() {
+	ring.flush();
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+// Trace log. GB_LOG statements compile to nothing unless GB_LOG_ENABLED is
+// set (default: debug builds only). When compiled in, messages pass a
+// runtime filter per category and level and are queued in a lock-free ring
+// buffer; a background thread writes them to stdout.
+#ifndef GB_LOG_ENABLED
+#ifdef NDEBUG
+#define GB_LOG_ENABLED (0)
+#else
+#define GB_LOG_ENABLED (1)
+#endif
+#endif
+
+#define LOG_RING_SIZE		(1024)	//power of 2
+#define LOG_MESSAGE_SIZE	(120)
+
+enum class LOG_CATEGORY {
+	CPU,
+	INTERRUPT,
+	MEMORY,
+	MBC,
+	INPUT,
+	SYSTEM,
+	LOG_CATEGORY_NUMS
+};
+
+enum class LOG_LEVEL {
+	ERR,
+	WARN,
+	INFO,
+	TRACE
+};
+
+class Log
+{
+public:
+	static bool enabled(LOG_CATEGORY category, LOG_LEVEL level) {
+		return static_cast<uint8_t>(level) <= levels[static_cast<int>(category)];
+	}
+	static void set_level(LOG_CATEGORY category, LOG_LEVEL level);
+	// comma separated category names or "all", enabled up to TRACE
+	static bool enable(const char* list);
+	static void write(LOG_CATEGORY category, LOG_LEVEL level, const std::string& message);
+	// wait until everything queued so far is written
+	static void flush();
+private:
+	static inline uint8_t levels[static_cast<int>(LOG_CATEGORY::LOG_CATEGORY_NUMS)] = {
+		1, 1, 1, 1, 1, 1	//errors and warnings
+	};
+};
+
+#if GB_LOG_ENABLED
+#define GB_LOG(category, level, message) \
+	do { \
+		if (Log::enabled(LOG_CATEGORY::category, LOG_LEVEL::level)) { \
+			std::ostringstream gb_log_stream; \
+			gb_log_stream << message; \
+			Log::write(LOG_CATEGORY::category, LOG_LEVEL::level, gb_log_stream.str()); \
+		} \
+	} while (0)
+#else
+#define GB_LOG(category, level, message) do {} while (0)
+#endif
@@ -0,0 +1,93 @@
+#include "Gameboy.h"
+
+// Mapper policies. write() updates the mapper registers for a write to
+// 0x0000-0x7FFF and derives the selected banks; Memory::write_mbc then swaps
+// the page pointers if a bank changed.
+
+// ROM only, RAM (if any) always enabled
+struct Memory::MBC_NONE {
+	static void write(Memory& m, uint16_t address, uint8_t data) {
+		GB_LOG(MBC, TRACE, "unable to write ROM");
+	}
+};
+
+struct Memory::MBC1 {
+	static void write(Memory& m, uint16_t address, uint8_t data) {
+		switch (address >> 13) {
+		case 0: m.ram_enabled = (data & 0x0F) == 0x0A; break;
+		case 1: m.bank_low = (data & 0x1F) ? (data & 0x1F) : 1; break;
+		case 2: m.bank_high = data & 0x03; break;
+		case 3: m.bank_mode = data & 0x01; break;
+		}
+		// the two upper bits extend the ROM bank, or select the RAM bank
+		// and the bank at 0x0000 in mode 1
+		m.rom_bank = m.bank_high << 5 | m.bank_low;
+		m.rom_bank0 = m.bank_mode ? m.bank_high << 5 : 0;
+		m.ram_bank = m.bank_mode ? m.bank_high : 0;
+	}
+};
+
+// the clock registers are plain storage, the clock itself does not run
+struct Memory::MBC3 {
+	static void write(Memory& m, uint16_t address, uint8_t data) {
+		switch (address >> 13) {
+		case 0: m.ram_enabled = (data & 0x0F) == 0x0A; break;
+		case 1: m.bank_low = (data & 0x7F) ? (data & 0x7F) : 1; break;
+		case 2: m.ram_bank = data; break;
+		case 3: m.bank_mode = data; break;	//clock latch
+		}
+		m.rom_bank = m.bank_low;
+	}
+};
+
+// 9 bit ROM bank, bank 0 can be selected at 0x4000
+struct Memory::MBC5 {
+	static void write(Memory& m, uint16_t address, uint8_t data) {
+		switch (address >> 12) {
+		case 0: case 1: m.ram_enabled = (data & 0x0F) == 0x0A; break;
+		case 2: m.bank_low = data; break;
+		case 3: m.bank_high = data & 0x01; break;
+		case 4: case 5: m.ram_bank = data & 0x0F; break;
+		}
+		m.rom_bank = m.bank_high << 8 | m.bank_low;
+	}
+};
+
+template<class MBC> void Memory::write_mbc(uint16_t address, uint8_t data)
+{
+	const uint16_t old_rom_bank = rom_bank;
+	const uint16_t old_rom_bank0 = rom_bank0;
+	const uint8_t old_ram_bank = ram_bank;
+	const bool old_ram_enabled = ram_enabled;
+
+	MBC::write(*this, address, data);
+
+	if (rom_bank != old_rom_bank || rom_bank0 != old_rom_bank0) {
+		GB_LOG(MBC, TRACE, "switch bank : " << rom_bank0 << " " << rom_bank);
+		map_rom_bank();
+	}
+	if (ram_bank != old_ram_bank || ram_enabled != old_ram_enabled) map_ram_bank();
+}
+
+void Memory::select_mapper(uint8_t cartridge_type)
+{
+	switch (cartridge_type) {
+	case 0x00: case 0x08: case 0x09:
+		mbc_write = &Memory::write_mbc<MBC_NONE>;
+		ram_enabled = true;
+		break;
+	case 0x01: case 0x02: case 0x03:
+		mbc_write = &Memory::write_mbc<MBC1>;
+		break;
+	case 0x0F: case 0x10: case 0x11: case 0x12: case 0x13:
+		mbc_write = &Memory::write_mbc<MBC3>;
+		break;
+	case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E:
+		mbc_write = &Memory::write_mbc<MBC5>;
+		break;
+	default:
+		GB_LOG(MBC, WARN, "unsupported cartridge type " << static_cast<int>(cartridge_type) << ", using MBC1");
+		mbc_write = &Memory::write_mbc<MBC1>;
+		break;
+	}
+}
@@ -0,0 +1,427 @@
+#include "PixelOps.h"
+#include "Log.h"
+#include <cstring>
+#include <random>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define PIXEL_X86 (1)
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PIXEL_TARGET(isa)
+#else
+#define PIXEL_TARGET(isa) __attribute__((target(isa)))
+#endif
+#else
+#define PIXEL_X86 (0)
+#endif
+
+// scalar reference kernels
+
+static void decode_row_scalar(uint8_t lo, uint8_t hi, uint8_t* out) {
+	for (int l = 0; l < 8; l++)
+		out[l] = (lo >> (7 - l) & 0x01) | (hi >> (7 - l) & 0x01) << 1;
+}
+
+static void apply_palette_scalar(const uint8_t* colors, uint8_t palette, uint8_t* out, size_t n) {
+	for (size_t x = 0; x < n; x++)
+		out[x] = palette >> (colors[x] * 2) & 0x03;
+}
+
+static void composite_scalar(uint8_t* line, const uint8_t* colors, const uint8_t* sprites, size_t n) {
+	for (size_t x = 0; x < n; x++) {
+		const uint8_t s = sprites[x];
+		if ((s & PIXEL_OBJ_OPAQUE) && (!(s & PIXEL_OBJ_BEHIND) || !colors[x])) line[x] = s & 0x03;
+	}
+}
+
+// Scale2x/Scale3x (AdvMAME): B, D, F, H are the pixels above, left, right
+// and below E, A, C, G, I the corners. nothing changes across a flat edge
+
+static void scale2x_row_scalar(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* out, size_t pitch, size_t n) {
+	for (size_t x = 0; x < n; x++) {
+		const uint8_t B = above[x], D = row[x - 1], E = row[x], F = row[x + 1], H = below[x];
+		uint8_t* o = out + x * 2;
+		if (B != H && D != F) {
+			o[0] = D == B ? D : E;
+			o[1] = B == F ? F : E;
+			o[pitch] = D == H ? D : E;
+			o[pitch + 1] = H == F ? F : E;
+		}
+		else {
+			o[0] = o[1] = o[pitch] = o[pitch + 1] = E;
+		}
+	}
+}
+
+static void scale3x_row_scalar(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* out, size_t pitch, size_t n) {
+	for (size_t x = 0; x < n; x++) {
+		const uint8_t A = above[x - 1], B = above[x], C = above[x + 1];
+		const uint8_t D = row[x - 1], E = row[x], F = row[x + 1];
+		const uint8_t G = below[x - 1], H = below[x], I = below[x + 1];
+		uint8_t* o0 = out + x * 3;
+		uint8_t* o1 = o0 + pitch;
+		uint8_t* o2 = o1 + pitch;
+		if (B != H && D != F) {
+			o0[0] = D == B ? D : E;
+			o0[1] = (D == B && E != C) || (B == F && E != A) ? B : E;
+			o0[2] = B == F ? F : E;
+			o1[0] = (D == B && E != G) || (D == H && E != A) ? D : E;
+			o1[1] = E;
+			o1[2] = (B == F && E != I) || (H == F && E != C) ? F : E;
+			o2[0] = D == H ? D : E;
+			o2[1] = (D == H && E != I) || (H == F && E != G) ? H : E;
+			o2[2] = H == F ? F : E;
+		}
+		else {
+			o0[0] = o0[1] = o0[2] = o1[0] = o1[1] = o1[2] = o2[0] = o2[1] = o2[2] = E;
+		}
+	}
+}
+
+void (*PixelOps::decode_row)(uint8_t lo, uint8_t hi, uint8_t* out) = decode_row_scalar;
+void (*PixelOps::apply_palette)(const uint8_t* colors, uint8_t palette, uint8_t* out, size_t n) = apply_palette_scalar;
+void (*PixelOps::composite)(uint8_t* line, const uint8_t* colors, const uint8_t* sprites, size_t n) = composite_scalar;
+void (*PixelOps::scale2x_row)(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* out, size_t pitch, size_t n) = scale2x_row_scalar;
+void (*PixelOps::scale3x_row)(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* out, size_t pitch, size_t n) = scale3x_row_scalar;
+
+#if PIXEL_X86
+
+// SSE2: bit n of each byte is tested against a mask per lane, palette
+// entries are picked with compares
+
+PIXEL_TARGET("sse2") static void decode_row_sse2(uint8_t lo, uint8_t hi, uint8_t* out) {
+	const __m128i bits = _mm_set_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80);
+	const __m128i l = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8((char)lo), bits), bits);
+	const __m128i h = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8((char)hi), bits), bits);
+	const __m128i px = _mm_or_si128(_mm_and_si128(l, _mm_set1_epi8(1)), _mm_and_si128(h, _mm_set1_epi8(2)));
+	_mm_storel_epi64(reinterpret_cast<__m128i*>(out), px);
+}
+
+PIXEL_TARGET("sse2") static void apply_palette_sse2(const uint8_t* colors, uint8_t palette, uint8_t* out, size_t n) {
+	const __m128i shade[4] = {
+		_mm_set1_epi8(palette & 0x03), _mm_set1_epi8(palette >> 2 & 0x03),
+		_mm_set1_epi8(palette >> 4 & 0x03), _mm_set1_epi8(palette >> 6 & 0x03)
+	};
+	size_t x = 0;
+	for (; x + 16 <= n; x += 16) {
+		const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colors + x));
+		__m128i px = _mm_setzero_si128();
+		for (int i = 0; i < 4; i++)
+			px = _mm_or_si128(px, _mm_and_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(static_cast<char>(i))), shade[i]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), px);
+	}
+	apply_palette_scalar(colors + x, palette, out + x, n - x);
+}
+
+PIXEL_TARGET("sse2") static void composite_sse2(uint8_t* line, const uint8_t* colors, const uint8_t* sprites, size_t n) {
+	const __m128i opaque = _mm_set1_epi8(PIXEL_OBJ_OPAQUE);
+	const __m128i behind = _mm_set1_epi8(PIXEL_OBJ_BEHIND);
+	size_t x = 0;
+	for (; x + 16 <= n; x += 16) {
+		const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sprites + x));
+		const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colors + x));
+		const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line + x));
+		const __m128i is_opaque = _mm_cmpeq_epi8(_mm_and_si128(s, opaque), opaque);
+		const __m128i is_behind = _mm_cmpeq_epi8(_mm_and_si128(s, behind), behind);
+		const __m128i bg_clear = _mm_cmpeq_epi8(c, _mm_setzero_si128());
+		const __m128i take = _mm_and_si128(is_opaque, _mm_or_si128(_mm_andnot_si128(is_behind, _mm_set1_epi8(-1)), bg_clear));
+		const __m128i px = _mm_and_si128(s, _mm_set1_epi8(0x03));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(line + x), _mm_or_si128(_mm_and_si128(take, px), _mm_andnot_si128(take, d)));
+	}
+	composite_scalar(line + x, colors + x, sprites + x, n - x);
+}
+
+#define SEL128(mask, a, b) _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b))
+
+PIXEL_TARGET("sse2") static void scale2x_row_sse2(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* out, size_t pitch, size_t n) {
+	size_t x = 0;
+	for (; x + 16 <= n; x += 16) {
+		const __m128i B = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x));
+		const __m128i D = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+		const __m128i E = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+		const __m128i F = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 1));
+		const __m128i H = _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + x));
+		const __m128i edge = _mm_andnot_si128(_mm_cmpeq_epi8(B, H), _mm_andnot_si128(_mm_cmpeq_epi8(D, F), _mm_set1_epi8(-1)));
+		const __m128i e0 = SEL128(_mm_and_si128(edge, _mm_cmpeq_epi8(D, B)), D, E);
+		const __m128i e1 = SEL128(_mm_and_si128(edge, _mm_cmpeq_epi8(B, F)), F, E);
+		const __m128i e2 = SEL128(_mm_and_si128(edge, _mm_cmpeq_epi8(D, H)), D, E);
+		const __m128i e3 = SEL128(_mm_and_si128(edge, _mm_cmpeq_epi8(H, F)), F, E);
+		__m128i* o0 = reinterpret_cast<__m128i*>(out + x * 2);
+		__m128i* o1 = reinterpret_cast<__m128i*>(out + pitch + x * 2);
+		_mm_storeu_si128(o0, _mm_unpacklo_epi8(e0, e1));
+		_mm_storeu_si128(o0 + 1, _mm_unpackhi_epi8(e0, e1));
+		_mm_storeu_si128(o1, _mm_unpacklo_epi8(e2, e3));
+		_mm_storeu_si128(o1 + 1, _mm_unpackhi_epi8(e2, e3));
+	}
+	scale2x_row_scalar(above + x, row + x, below + x, out + x * 2, pitch, n - x);
+}
+
+// SSSE3: the palette is a 4 entry table for pshufb
+
+PIXEL_TARGET("ssse3") static void apply_palette_ssse3(const uint8_t* colors, uint8_t palette, uint8_t* out, size_t n) {
+	const __m128i table = _mm_setr_epi8(palette & 0x03, palette >> 2 & 0x03, palette >> 4 & 0x03, palette >> 6 & 0x03,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	size_t x = 0;
+	for (; x + 16 <= n; x += 16) {
+		const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colors + x));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_shuffle_epi8(table, _mm_and_si128(c, _mm_set1_epi8(0x03))));
+	}
+	apply_palette_scalar(colors + x, palette, out + x, n - x);
+}
+
+// pshufb masks spreading 3 vectors over 48 bytes as a0 b0 c0 a1 b1 c1 ...
+struct INTERLEAVE3 {
+	int8_t mask[3][3][16];	//output chunk, source vector, byte
+};
+static const INTERLEAVE3 interleave3 = [] {
+	INTERLEAVE3 t = {};
+	for (int chunk = 0; chunk < 3; chunk++)
+		for (int src = 0; src < 3; src++)
+			for (int i = 0; i < 16; i++) {
+				const int pos = chunk * 16 + i;
+				t.mask[chunk][src][i] = pos % 3 == src ? static_cast<int8_t>(pos / 3) : -128;
+			}
+	return t;
+}();
+
+PIXEL_TARGET("ssse3") static void store_interleave3(uint8_t* out, __m128i a, __m128i b, __m128i c) {
+	for (int chunk = 0; chunk < 3; chunk++) {
+		const __m128i* m = reinterpret_cast<const __m128i*>(interleave3.mask[chunk]);
+		const __m128i v = _mm_or_si128(_mm_or_si128(
+			_mm_shuffle_epi8(a, _mm_loadu_si128(m)), _mm_shuffle_epi8(b, _mm_loadu_si128(m + 1))),
+			_mm_shuffle_epi8(c, _mm_loadu_si128(m + 2)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + chunk * 16), v);
+	}
+}
+
+PIXEL_TARGET("ssse3") static void scale3x_row_ssse3(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* out, size_t pitch, size_t n) {
+	size_t x = 0;
+	for (; x + 16 <= n; x += 16) {
+		const __m128i A = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x - 1));
+		const __m128i B = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x));
+		const __m128i C = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x + 1));
+		const __m128i D = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+		const __m128i E = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+		const __m128i F = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 1));
+		const __m128i G = _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + x - 1));
+		const __m128i H = _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + x));
+		const __m128i I = _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + x + 1));
+		const __m128i ones = _mm_set1_epi8(-1);
+		const __m128i edge = _mm_andnot_si128(_mm_cmpeq_epi8(B, H), _mm_andnot_si128(_mm_cmpeq_epi8(D, F), ones));
+		const __m128i db = _mm_and_si128(edge, _mm_cmpeq_epi8(D, B));
+		const __m128i bf = _mm_and_si128(edge, _mm_cmpeq_epi8(B, F));
+		const __m128i dh = _mm_and_si128(edge, _mm_cmpeq_epi8(D, H));
+		const __m128i hf = _mm_and_si128(edge, _mm_cmpeq_epi8(H, F));
+		const __m128i not_a = _mm_andnot_si128(_mm_cmpeq_epi8(E, A), ones);
+		const __m128i not_c = _mm_andnot_si128(_mm_cmpeq_epi8(E, C), ones);
+		const __m128i not_g = _mm_andnot_si128(_mm_cmpeq_epi8(E, G), ones);
+		const __m128i not_i = _mm_andnot_si128(_mm_cmpeq_epi8(E, I), ones);
+		uint8_t* o = out + x * 3;
+		store_interleave3(o,
+			SEL128(db, D, E),
+			SEL128(_mm_or_si128(_mm_and_si128(db, not_c), _mm_and_si128(bf, not_a)), B, E),
+			SEL128(bf, F, E));
+		store_interleave3(o + pitch,
+			SEL128(_mm_or_si128(_mm_and_si128(db, not_g), _mm_and_si128(dh, not_a)), D, E),
+			E,
+			SEL128(_mm_or_si128(_mm_and_si128(bf, not_i), _mm_and_si128(hf, not_c)), F, E));
+		store_interleave3(o + pitch * 2,
+			SEL128(dh, D, E),
+			SEL128(_mm_or_si128(_mm_and_si128(dh, not_i), _mm_and_si128(hf, not_g)), H, E),
+			SEL128(hf, F, E));
+	}
+	scale3x_row_scalar(above + x, row + x, below + x, out + x * 3, pitch, n - x);
+}
+
+// AVX2: 32 pixels per step, 160 pixel lines are 5 steps
+
+PIXEL_TARGET("avx2") static void apply_palette_avx2(const uint8_t* colors, uint8_t palette, uint8_t* out, size_t n) {
+	const __m256i table = _mm256_setr_epi8(palette & 0x03, palette >> 2 & 0x03, palette >> 4 & 0x03, palette >> 6 & 0x03,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		palette & 0x03, palette >> 2 & 0x03, palette >> 4 & 0x03, palette >> 6 & 0x03,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	size_t x = 0;
+	for (; x + 32 <= n; x += 32) {
+		const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colors + x));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), _mm256_shuffle_epi8(table, _mm256_and_si256(c, _mm256_set1_epi8(0x03))));
+	}
+	apply_palette_scalar(colors + x, palette, out + x, n - x);
+}
+
+PIXEL_TARGET("avx2") static void composite_avx2(uint8_t* line, const uint8_t* colors, const uint8_t* sprites, size_t n) {
+	const __m256i opaque = _mm256_set1_epi8(PIXEL_OBJ_OPAQUE);
+	const __m256i behind = _mm256_set1_epi8(PIXEL_OBJ_BEHIND);
+	size_t x = 0;
+	for (; x + 32 <= n; x += 32) {
+		const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sprites + x));
+		const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colors + x));
+		const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(line + x));
+		const __m256i is_opaque = _mm256_cmpeq_epi8(_mm256_and_si256(s, opaque), opaque);
+		const __m256i is_behind = _mm256_cmpeq_epi8(_mm256_and_si256(s, behind), behind);
+		const __m256i bg_clear = _mm256_cmpeq_epi8(c, _mm256_setzero_si256());
+		const __m256i take = _mm256_and_si256(is_opaque, _mm256_or_si256(_mm256_andnot_si256(is_behind, _mm256_set1_epi8(-1)), bg_clear));
+		const __m256i px = _mm256_and_si256(s, _mm256_set1_epi8(0x03));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(line + x), _mm256_blendv_epi8(d, px, take));
+	}
+	composite_scalar(line + x, colors + x, sprites + x, n - x);
+}
+
+PIXEL_TARGET("avx2") static void scale2x_row_avx2(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* out, size_t pitch, size_t n) {
+	size_t x = 0;
+	for (; x + 32 <= n; x += 32) {
+		const __m256i B = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(above + x));
+		const __m256i D = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x - 1));
+		const __m256i E = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+		const __m256i F = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x + 1));
+		const __m256i H = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(below + x));
+		const __m256i edge = _mm256_andnot_si256(_mm256_cmpeq_epi8(B, H), _mm256_andnot_si256(_mm256_cmpeq_epi8(D, F), _mm256_set1_epi8(-1)));
+		const __m256i e0 = _mm256_blendv_epi8(E, D, _mm256_and_si256(edge, _mm256_cmpeq_epi8(D, B)));
+		const __m256i e1 = _mm256_blendv_epi8(E, F, _mm256_and_si256(edge, _mm256_cmpeq_epi8(B, F)));
+		const __m256i e2 = _mm256_blendv_epi8(E, D, _mm256_and_si256(edge, _mm256_cmpeq_epi8(D, H)));
+		const __m256i e3 = _mm256_blendv_epi8(E, F, _mm256_and_si256(edge, _mm256_cmpeq_epi8(H, F)));
+		//unpack works within 128 bit lanes, put the halves back in order
+		const __m256i lo01 = _mm256_unpacklo_epi8(e0, e1), hi01 = _mm256_unpackhi_epi8(e0, e1);
+		const __m256i lo23 = _mm256_unpacklo_epi8(e2, e3), hi23 = _mm256_unpackhi_epi8(e2, e3);
+		__m256i* o0 = reinterpret_cast<__m256i*>(out + x * 2);
+		__m256i* o1 = reinterpret_cast<__m256i*>(out + pitch + x * 2);
+		_mm256_storeu_si256(o0, _mm256_permute2x128_si256(lo01, hi01, 0x20));
+		_mm256_storeu_si256(o0 + 1, _mm256_permute2x128_si256(lo01, hi01, 0x31));
+		_mm256_storeu_si256(o1, _mm256_permute2x128_si256(lo23, hi23, 0x20));
+		_mm256_storeu_si256(o1 + 1, _mm256_permute2x128_si256(lo23, hi23, 0x31));
+	}
+	scale2x_row_scalar(above + x, row + x, below + x, out + x * 2, pitch, n - x);
+}
+
+#endif
+
+bool PixelOps::supported(PIXEL_ISA isa) {
+	if (isa == PIXEL_ISA::SCALAR) return true;
+#if PIXEL_X86
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuid(regs, 1);
+	const bool sse2 = regs[3] >> 26 & 1;
+	const bool ssse3 = regs[2] >> 9 & 1;
+	const bool os_avx = (regs[2] >> 27 & 1) && (_xgetbv(0) & 0x06) == 0x06;	//OSXSAVE, YMM state saved
+	__cpuidex(regs, 7, 0);
+	const bool avx2 = os_avx && (regs[1] >> 5 & 1);
+#else
+	__builtin_cpu_init();
+	const bool sse2 = __builtin_cpu_supports("sse2");
+	const bool ssse3 = __builtin_cpu_supports("ssse3");
+	const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+	switch (isa) {
+	case PIXEL_ISA::SSE2: return sse2;
+	case PIXEL_ISA::SSSE3: return sse2 && ssse3;
+	case PIXEL_ISA::AVX2: return sse2 && ssse3 && avx2;
+	default: return false;
+	}
+#else
+	return false;
+#endif
+}
+
+PIXEL_ISA PixelOps::select(PIXEL_ISA max) {
+	isa = PIXEL_ISA::SCALAR;
+	decode_row = decode_row_scalar;
+	apply_palette = apply_palette_scalar;
+	composite = composite_scalar;
+	scale2x_row = scale2x_row_scalar;
+	scale3x_row = scale3x_row_scalar;
+#if PIXEL_X86
+	// a level without its own version of a kernel keeps the one below it
+	for (int i = static_cast<int>(PIXEL_ISA::SSE2); i <= static_cast<int>(max); i++) {
+		const PIXEL_ISA level = static_cast<PIXEL_ISA>(i);
+		if (!supported(level)) break;
+		isa = level;
+		switch (level) {
+		case PIXEL_ISA::SSE2:
+			decode_row = decode_row_sse2;
+			apply_palette = apply_palette_sse2;
+			composite = composite_sse2;
+			scale2x_row = scale2x_row_sse2;
+			break;
+		case PIXEL_ISA::SSSE3:
+			apply_palette = apply_palette_ssse3;
+			scale3x_row = scale3x_row_ssse3;
+			break;
+		case PIXEL_ISA::AVX2:
+			apply_palette = apply_palette_avx2;
+			composite = composite_avx2;
+			scale2x_row = scale2x_row_avx2;
+			break;
+		default:
+			break;
+		}
+	}
+#endif
+#ifndef NDEBUG
+	if (isa != PIXEL_ISA::SCALAR && !self_check()) {
+		GB_LOG(SYSTEM, ERR, name(isa) << " pixel kernels differ from scalar, using scalar");
+		return select(PIXEL_ISA::SCALAR);
+	}
+#endif
+	GB_LOG(SYSTEM, INFO, "pixel kernels: " << name(isa));
+	return isa;
+}
+
+// compare the selected kernels with the scalar ones, every tile row and
+// palette and random lines and rows of odd lengths to cover the scalar tails
+bool PixelOps::self_check() {
+	for (int row = 0; row < 0x10000; row++) {
+		uint8_t expected[8], actual[8];
+		decode_row_scalar(row & 0xFF, row >> 8, expected);
+		decode_row(row & 0xFF, row >> 8, actual);
+		if (std::memcmp(expected, actual, sizeof(expected))) return false;
+	}
+
+	std::mt19937 random(1);
+	uint8_t colors[167], sprites[167], expected[167], actual[167];
+	for (int palette = 0; palette < 0x100; palette++) {
+		const size_t n = 160 + palette % 8;
+		for (size_t x = 0; x < n; x++) {
+			colors[x] = random() & 0x03;
+			sprites[x] = random() & 0x0F;
+			expected[x] = actual[x] = random() & 0x03;
+		}
+		apply_palette_scalar(colors, static_cast<uint8_t>(palette), expected, n);
+		apply_palette(colors, static_cast<uint8_t>(palette), actual, n);
+		if (std::memcmp(expected, actual, n)) return false;
+		composite_scalar(expected, colors, sprites, n);
+		composite(actual, colors, sprites, n);
+		if (std::memcmp(expected, actual, n)) return false;
+	}
+
+	// three padded rows with few colors so that edges are common
+	uint8_t rows[3][171], scaled_expected[3 * 3 * 169], scaled_actual[3 * 3 * 169];
+	for (int run = 0; run < 0x100; run++) {
+		const size_t n = 160 + run % 9;
+		for (auto& r : rows)
+			for (size_t x = 0; x < n + 2; x++) r[x] = random() % 3;
+		const size_t pitch = n * 3;
+		scale2x_row_scalar(rows[0] + 1, rows[1] + 1, rows[2] + 1, scaled_expected, pitch, n);
+		scale2x_row(rows[0] + 1, rows[1] + 1, rows[2] + 1, scaled_actual, pitch, n);
+		for (int y = 0; y < 2; y++)
+			if (std::memcmp(scaled_expected + y * pitch, scaled_actual + y * pitch, n * 2)) return false;
+		scale3x_row_scalar(rows[0] + 1, rows[1] + 1, rows[2] + 1, scaled_expected, pitch, n);
+		scale3x_row(rows[0] + 1, rows[1] + 1, rows[2] + 1, scaled_actual, pitch, n);
+		if (std::memcmp(scaled_expected, scaled_actual, pitch * 3)) return false;
+	}
+	return true;
+}
+
+const char* PixelOps::name(PIXEL_ISA isa) {
+	static const char* names[] = { "scalar", "sse2", "ssse3", "avx2" };
+	return names[static_cast<int>(isa)];
+}
+
+bool PixelOps::parse(const char* str, PIXEL_ISA& isa) {
+	for (int i = 0; i < static_cast<int>(PIXEL_ISA::PIXEL_ISA_NUMS); i++) {
+		if (std::strcmp(str, name(static_cast<PIXEL_ISA>(i)))) continue;
+		isa = static_cast<PIXEL_ISA>(i);
+		return true;
+	}
+	return false;
+}
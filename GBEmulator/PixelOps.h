@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#define PIXEL_OBJ_OPAQUE	(0x04)	//sprite layer: a sprite pixel is present
+#define PIXEL_OBJ_BEHIND	(0x08)	//sprite layer: only drawn over background color 0
+
+enum class PIXEL_ISA {
+	SCALAR,
+	SSE2,
+	SSSE3,
+	AVX2,
+	PIXEL_ISA_NUMS
+};
+
+// packed frame formats the GPU can write besides its shade buffer
+enum class PIXEL_FORMAT {
+	NONE,
+	RGBA8888,	//bytes R, G, B, A
+	RGB565,		//native endian 16 bit
+	PIXEL_FORMAT_NUMS
+};
+
+// Pixel kernels used by the GPU. Every kernel has a scalar version and
+// x86 vector versions; the scalar ones are used until select() points them
+// at the best set the host CPU supports. Debug builds compare the vector
+// kernels with the scalar ones there and keep scalar on any difference.
+class PixelOps
+{
+public:
+	// 8 color numbers from one 2bpp tile row, lo is the first byte (bit 0)
+	static void (*decode_row)(uint8_t lo, uint8_t hi, uint8_t* out);
+	// out[x] = shade of colors[x] in a BGP/OBP style palette
+	static void (*apply_palette)(const uint8_t* colors, uint8_t palette, uint8_t* out, size_t n);
+	// draw the sprite layer over line. sprite bytes are 0 or PIXEL_OBJ_OPAQUE
+	// | shade, plus PIXEL_OBJ_BEHIND to hide behind background colors 1-3
+	static void (*composite)(uint8_t* line, const uint8_t* colors, const uint8_t* sprites, size_t n);
+	// one source row of Scale2x/Scale3x into 2 or 3 output rows pitch apart.
+	// above, row and below are read from index -1 to n
+	static void (*scale2x_row)(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* out, size_t pitch, size_t n);
+	static void (*scale3x_row)(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* out, size_t pitch, size_t n);
+
+	// use the best kernels up to max, returns the set in use
+	static PIXEL_ISA select(PIXEL_ISA max = PIXEL_ISA::AVX2);
+	static PIXEL_ISA selected() { return isa; }
+	static const char* name(PIXEL_ISA isa);
+	// parse "scalar", "sse2", "ssse3" or "avx2"
+	static bool parse(const char* str, PIXEL_ISA& isa);
+private:
+	static inline PIXEL_ISA isa = PIXEL_ISA::SCALAR;
+	static bool supported(PIXEL_ISA isa);
+	static bool self_check();
+};
@@ -0,0 +1,81 @@
+#include "Profiler.h"
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+
+void Profiler::clear() {
+	for (auto& c : ops) c = Counter{ 0, 0 };
+	for (auto& c : cb_ops) c = Counter{ 0, 0 };
+	pcs.assign(0x10000, Counter{ 0, 0 });
+}
+
+bool Profiler::dump(const char* path) const {
+	size_t len = std::strlen(path);
+	if (len >= 5 && !std::strcmp(path + len - 5, ".json")) return dump_json(path);
+	return dump_csv(path);
+}
+
+// bank and address of an entry in pcs
+static void pc_location(size_t index, unsigned& bank, unsigned& pc) {
+	if (index < 0x10000) {
+		bank = 0;
+		pc = static_cast<unsigned>(index);
+		return;
+	}
+	bank = static_cast<unsigned>((index - 0x10000) / 0x4000);
+	pc = static_cast<unsigned>(0x4000 + (index - 0x10000) % 0x4000);
+}
+
+// one row per non-zero counter: kind,bank,pc,opcode,count,cycles
+bool Profiler::dump_csv(const char* path) const {
+	std::ofstream ofs(path);
+	if (ofs.fail()) return false;
+
+	ofs << "kind,bank,pc,opcode,count,cycles\n";
+	ofs << std::hex << std::setfill('0');
+	for (int i = 0; i < 0x100; i++) {
+		if (!ops[i].count) continue;
+		ofs << "op,,,0x" << std::setw(2) << i << std::dec << "," << ops[i].count << "," << ops[i].cycles << std::hex << "\n";
+	}
+	for (int i = 0; i < 0x100; i++) {
+		if (!cb_ops[i].count) continue;
+		ofs << "cb,,,0x" << std::setw(2) << i << std::dec << "," << cb_ops[i].count << "," << cb_ops[i].cycles << std::hex << "\n";
+	}
+	for (size_t i = 0; i < pcs.size(); i++) {
+		if (!pcs[i].count) continue;
+		unsigned bank, pc;
+		pc_location(i, bank, pc);
+		ofs << std::dec << "pc," << bank << ",0x" << std::hex << std::setw(4) << pc << ",," << std::dec << pcs[i].count << "," << pcs[i].cycles << "\n";
+	}
+	return !ofs.fail();
+}
+
+bool Profiler::dump_json(const char* path) const {
+	std::ofstream ofs(path);
+	if (ofs.fail()) return false;
+
+	auto dump_ops = [&ofs](const char* name, const Counter* table) {
+		ofs << "  \"" << name << "\": [";
+		const char* sep = "\n";
+		for (int i = 0; i < 0x100; i++) {
+			if (!table[i].count) continue;
+			ofs << sep << "    {\"opcode\": " << i << ", \"count\": " << table[i].count << ", \"cycles\": " << table[i].cycles << "}";
+			sep = ",\n";
+		}
+		ofs << "\n  ],\n";
+	};
+	ofs << "{\n";
+	dump_ops("opcodes", ops);
+	dump_ops("cb_opcodes", cb_ops);
+	ofs << "  \"pcs\": [";
+	const char* sep = "\n";
+	for (size_t i = 0; i < pcs.size(); i++) {
+		if (!pcs[i].count) continue;
+		unsigned bank, pc;
+		pc_location(i, bank, pc);
+		ofs << sep << "    {\"bank\": " << bank << ", \"pc\": " << pc << ", \"count\": " << pcs[i].count << ", \"cycles\": " << pcs[i].cycles << "}";
+		sep = ",\n";
+	}
+	ofs << "\n  ]\n}\n";
+	return !ofs.fail();
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Execution profile: executions and T-cycles per opcode, per CB opcode and
+// per (ROM bank, PC). Only fed when the core is built with GB_PROFILE.
+class Profiler
+{
+public:
+	struct Counter {
+		uint64_t count;
+		uint64_t cycles;
+	};
+
+	void count(uint8_t op, uint16_t bank, uint16_t pc, uint8_t cycles) {
+		ops[op].count++;
+		ops[op].cycles += cycles;
+		Counter& c = pc_counter(bank, pc);
+		c.count++;
+		c.cycles += cycles;
+	}
+	void count_cb(uint8_t op, uint8_t cycles) {
+		cb_ops[op].count++;
+		cb_ops[op].cycles += cycles;
+	}
+	void clear();
+	// JSON when path ends with .json, CSV otherwise
+	bool dump(const char* path) const;
+private:
+	Counter ops[0x100] = {};
+	Counter cb_ops[0x100] = {};
+	// 0x0000-0xFFFF by address, then one 0x4000 block per switchable bank
+	std::vector<Counter> pcs = std::vector<Counter>(0x10000, Counter{ 0, 0 });
+
+	Counter& pc_counter(uint16_t bank, uint16_t pc) {
+		if (pc < 0x4000 || pc >= 0x8000) return pcs[pc];
+		size_t index = 0x10000 + static_cast<size_t>(bank) * 0x4000 + (pc - 0x4000);
+		if (index >= pcs.size()) pcs.resize(index - (pc - 0x4000) + 0x4000, Counter{ 0, 0 });
+		return pcs[index];
+	}
+	bool dump_csv(const char* path) const;
+	bool dump_json(const char* path) const;
+};
@@ -0,0 +1,90 @@
+#include "RomImage.h"
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define ROM_MIN_SIZE (0x8000)	//bank 0 and 1 are always mapped
+
+std::shared_ptr<const RomImage> RomImage::open(const std::string& path) {
+	static std::mutex lock;
+	static std::map<std::string, std::weak_ptr<const RomImage> > images;
+
+	std::lock_guard<std::mutex> guard(lock);
+	auto& cached = images[path];
+	if (auto image = cached.lock()) return image;
+
+	std::shared_ptr<RomImage> image(new RomImage());
+	if (!image->map_file(path) && !image->read_file(path)) return nullptr;
+	cached = image;
+	return image;
+}
+
+RomImage::~RomImage() {
+	if (!view) return;
+#ifdef _WIN32
+	UnmapViewOfFile(view);
+#else
+	munmap(view, length);
+#endif
+}
+
+bool RomImage::map_file(const std::string& path) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart < ROM_MIN_SIZE) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping) return false;
+	view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);	//the view keeps the mapping alive
+	if (!view) return false;
+	length = static_cast<size_t>(file_size.QuadPart);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < ROM_MIN_SIZE) {
+		close(fd);
+		return false;
+	}
+	void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);	//the mapping keeps the file alive
+	if (p == MAP_FAILED) return false;
+	view = p;
+	length = static_cast<size_t>(st.st_size);
+#endif
+	bytes = static_cast<const uint8_t*>(view);
+	return true;
+}
+
+// copy into the heap, padded with 0xFF up to 32KB
+bool RomImage::read_file(const std::string& path) {
+	std::ifstream ifs(path, std::ios::in | std::ios::binary);
+	if (ifs.fail()) return false;
+	ifs.seekg(0, ifs.end);
+	size_t file_size = static_cast<size_t>(ifs.tellg());
+	ifs.seekg(0, ifs.beg);
+
+	length = file_size < ROM_MIN_SIZE ? ROM_MIN_SIZE : file_size;
+	heap = std::make_unique<uint8_t[]>(length);
+	std::memset(heap.get(), 0xFF, length);
+	ifs.read(reinterpret_cast<char*>(heap.get()), file_size);
+	if (ifs.fail()) return false;
+	bytes = heap.get();
+	return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Read-only ROM file mapped into memory. Images are shared: opening the same
+// path again returns the live image, and the mapping is released when the
+// last Gameboy referencing it is gone. Bank pages point straight into it.
+class RomImage
+{
+public:
+	// nullptr when the file can not be read
+	static std::shared_ptr<const RomImage> open(const std::string& path);
+	~RomImage();
+	RomImage(const RomImage&) = delete;
+	RomImage& operator=(const RomImage&) = delete;
+
+	const uint8_t* data() const { return bytes; }
+	size_t size() const { return length; }
+	// 16KB banks actually present in the file
+	size_t bank_count() const { return length / 0x4000; }
+private:
+	RomImage() = default;
+	bool map_file(const std::string& path);
+	bool read_file(const std::string& path);
+
+	const uint8_t* bytes = nullptr;
+	size_t length = 0;
+	void* view = nullptr;					//mapped view, nullptr when read into heap
+	std::unique_ptr<uint8_t[]> heap;		//fallback copy, also used for files under 32KB
+};
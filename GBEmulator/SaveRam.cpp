@@ -0,0 +1,95 @@
+#include "SaveRam.h"
+#include "Log.h"
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SaveRam::SaveRam(size_t size, const std::string& path)
+	: length(size)
+{
+	if (!path.empty() && map_file(path)) {
+		bytes = static_cast<uint8_t*>(view);
+		flusher = std::thread(&SaveRam::flush_loop, this);
+		return;
+	}
+	if (!path.empty()) GB_LOG(MBC, WARN, "unable to map " << path << ", save RAM is not persisted");
+	heap = std::make_unique<uint8_t[]>(length);
+	std::memset(heap.get(), 0, length);
+	bytes = heap.get();
+}
+
+SaveRam::~SaveRam() {
+	if (flusher.joinable()) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_one();
+		flusher.join();
+	}
+	if (!view) return;
+	flush();
+#ifdef _WIN32
+	UnmapViewOfFile(view);
+#else
+	munmap(view, length);
+#endif
+}
+
+// open or create the file, sized to the cartridge RAM. existing contents are kept
+bool SaveRam::map_file(const std::string& path) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, static_cast<DWORD>(length), nullptr);
+	CloseHandle(file);
+	if (!mapping) return false;
+	view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, length);
+	CloseHandle(mapping);	//the view keeps the mapping alive
+	return view != nullptr;
+#else
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (static_cast<size_t>(st.st_size) != length && ftruncate(fd, static_cast<off_t>(length)) != 0)) {
+		close(fd);
+		return false;
+	}
+	void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);	//the mapping keeps the file alive
+	if (p == MAP_FAILED) return false;
+	view = p;
+	return true;
+#endif
+}
+
+void SaveRam::flush() {
+	if (!view) return;
+	uint32_t pages = dirty.exchange(0, std::memory_order_acquire);
+	for (size_t page = 0; pages; page++, pages >>= 1) {
+		if (!(pages & 1)) continue;
+		size_t offset = page << SAVE_PAGE_SHIFT;
+		size_t size = length - offset < (1u << SAVE_PAGE_SHIFT) ? length - offset : (1u << SAVE_PAGE_SHIFT);
+#ifdef _WIN32
+		FlushViewOfFile(bytes + offset, size);
+#else
+		msync(bytes + offset, size, MS_SYNC);
+#endif
+	}
+}
+
+void SaveRam::flush_loop() {
+	std::unique_lock<std::mutex> guard(lock);
+	while (!stopping) {
+		wake.wait_for(guard, std::chrono::milliseconds(SAVE_FLUSH_INTERVAL));
+		flush();
+	}
+}
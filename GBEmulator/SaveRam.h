@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define SAVE_PAGE_SHIFT		(12)	//dirty tracking granularity, 4KB
+#define SAVE_FLUSH_INTERVAL	(1000)	//ms between background flushes
+
+// Cartridge RAM. With a path the RAM is a shared mapping of the .sav file;
+// writes mark their 4KB page dirty and a background thread flushes only
+// those pages, so the emulation thread never waits for the disk. Without a
+// path (or if the file can not be mapped) it is plain memory.
+class SaveRam
+{
+public:
+	SaveRam(size_t size, const std::string& path);
+	~SaveRam();
+	SaveRam(const SaveRam&) = delete;
+	SaveRam& operator=(const SaveRam&) = delete;
+
+	uint8_t* data() { return bytes; }
+	size_t size() const { return length; }
+	bool persistent() const { return view != nullptr; }
+	void mark_dirty(size_t offset) {
+		dirty.fetch_or(1u << (offset >> SAVE_PAGE_SHIFT), std::memory_order_relaxed);
+	}
+	// write every dirty page now
+	void flush();
+private:
+	bool map_file(const std::string& path);
+	void flush_loop();
+
+	uint8_t* bytes = nullptr;
+	size_t length = 0;
+	void* view = nullptr;
+	std::unique_ptr<uint8_t[]> heap;
+	std::atomic<uint32_t> dirty = { 0 };	//one bit per page, cart RAM is at most 128KB
+	std::mutex lock;
+	std::condition_variable wake;
+	bool stopping = false;
+	std::thread flusher;
+};
@@ -0,0 +1,125 @@
+#include "Scaler.h"
+#include "PixelOps.h"
+#include <cstdlib>
+#include <cstring>
+
+Scaler::Scaler(SCALER type, int width, int height, ThreadPool* pool)
+	: width(width), height(height), pool(pool)
+{
+	switch (type) {
+	case SCALER::SCALE2X: passes = { PASS::SCALE2X }; break;
+	case SCALER::SCALE3X: passes = { PASS::SCALE3X }; break;
+	case SCALER::SCALE4X: passes = { PASS::SCALE2X, PASS::SCALE2X }; break;
+	case SCALER::XBR2X: passes = { PASS::XBR2X }; break;
+	case SCALER::XBR4X: passes = { PASS::XBR2X, PASS::XBR2X }; break;
+	default: break;
+	}
+	images.resize(passes.size());
+	for (size_t i = 0; i < passes.size(); i++) {
+		images[i].resize(width * scale, height * scale);
+		scale *= pass_factor(passes[i]);
+	}
+}
+
+void Scaler::Image::resize(int w, int h) {
+	width = w;
+	height = h;
+	pitch = w + SCALER_PAD * 2;
+	pixels.assign(pitch * (h + SCALER_PAD * 2), 0);
+}
+
+// repeat the edge pixels into the border
+void Scaler::Image::pad() {
+	for (int y = 0; y < height; y++) {
+		uint8_t* r = row(y);
+		std::memset(r - SCALER_PAD, r[0], SCALER_PAD);
+		std::memset(r + width, r[width - 1], SCALER_PAD);
+	}
+	for (int i = 1; i <= SCALER_PAD; i++) {
+		std::memcpy(row(-i) - SCALER_PAD, row(0) - SCALER_PAD, pitch);
+		std::memcpy(row(height - 1 + i) - SCALER_PAD, row(height - 1) - SCALER_PAD, pitch);
+	}
+}
+
+void Scaler::run(const uint8_t* src, uint8_t* dst) {
+	if (passes.empty()) {
+		std::memcpy(dst, src, static_cast<size_t>(width) * height);
+		return;
+	}
+	for (int y = 0; y < height; y++) std::memcpy(images[0].row(y), src + static_cast<size_t>(y) * width, width);
+	images[0].pad();
+	for (size_t i = 0; i < passes.size(); i++) {
+		const bool last = i + 1 == passes.size();
+		if (last) {
+			run_pass(passes[i], images[i], dst, output_width());
+		}
+		else {
+			Image& next = images[i + 1];
+			run_pass(passes[i], images[i], next.row(0), next.pitch);
+			next.pad();
+		}
+	}
+}
+
+// all source rows of one pass, in bands
+void Scaler::run_pass(PASS pass, Image& src, uint8_t* dst, size_t pitch) {
+	const int factor = pass_factor(pass);
+	const size_t bands = pool ? pool->size() + 1 : 1;
+	ThreadPool::BAND band = [&](size_t begin, size_t end) {
+		for (int y = static_cast<int>(begin); y < static_cast<int>(end); y++) {
+			uint8_t* out = dst + static_cast<size_t>(y) * factor * pitch;
+			switch (pass) {
+			case PASS::SCALE2X: PixelOps::scale2x_row(src.row(y - 1), src.row(y), src.row(y + 1), out, pitch, src.width); break;
+			case PASS::SCALE3X: PixelOps::scale3x_row(src.row(y - 1), src.row(y), src.row(y + 1), out, pitch, src.width); break;
+			case PASS::XBR2X: xbr2x_row(src, y, out, pitch); break;
+			}
+		}
+	};
+	if (pool) pool->parallel_for(src.height, bands, band);
+	else band(0, src.height);
+}
+
+// xBR-lite: the first level of xBR without blending. for each corner of E,
+// color changes are summed along the F-H diagonal next to the corner and
+// along the E-I diagonal through it. if F-H is the smoother one an edge
+// cuts the corner, which then takes the closer of F and H
+void Scaler::xbr2x_row(Image& src, int y, uint8_t* out, size_t pitch) {
+	const uint8_t* rows[5] = { src.row(y - 2), src.row(y - 1), src.row(y), src.row(y + 1), src.row(y + 2) };
+	auto d = [](uint8_t a, uint8_t b) { return std::abs(a - b); };
+	for (int x = 0; x < src.width; x++) {
+		const uint8_t e = rows[2][x];
+		//no corner can change without a differing side neighbor
+		if (rows[1][x] == e && rows[3][x] == e && rows[2][x - 1] == e && rows[2][x + 1] == e) {
+			out[x * 2] = out[x * 2 + 1] = out[pitch + x * 2] = out[pitch + x * 2 + 1] = e;
+			continue;
+		}
+		for (int corner = 0; corner < 4; corner++) {
+			const int dx = corner & 1 ? 1 : -1;
+			const int dy = corner & 2 ? 1 : -1;
+			//pixel u steps towards the corner horizontally and v vertically
+			auto p = [&](int u, int v) { return rows[2 + v * dy][x + u * dx]; };
+			const uint8_t f = p(1, 0), h = p(0, 1), i = p(1, 1);
+			uint8_t px = e;
+			if (e != f && e != h) {
+				const int along_fh = d(e, p(1, -1)) + d(e, p(-1, 1)) + d(i, p(2, 0)) + d(i, p(0, 2)) + 4 * d(h, f);
+				const int along_ei = d(h, p(-1, 0)) + d(h, p(1, 2)) + d(f, p(2, 1)) + d(f, p(0, -1)) + 4 * d(e, i);
+				if (along_fh < along_ei) px = d(e, f) <= d(e, h) ? f : h;
+			}
+			out[(corner >> 1) * pitch + x * 2 + (corner & 1)] = px;
+		}
+	}
+}
+
+const char* Scaler::name(SCALER type) {
+	static const char* names[] = { "scale2x", "scale3x", "scale4x", "xbr2x", "xbr4x" };
+	return names[static_cast<int>(type)];
+}
+
+bool Scaler::parse(const char* str, SCALER& type) {
+	for (int i = 0; i < static_cast<int>(SCALER::SCALER_NUMS); i++) {
+		if (std::strcmp(str, name(static_cast<SCALER>(i)))) continue;
+		type = static_cast<SCALER>(i);
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ThreadPool.h"
+
+#define SCALER_PAD (2)	//border around intermediate images, xBR reads 2 pixels out
+
+enum class SCALER {
+	SCALE2X,
+	SCALE3X,
+	SCALE4X,	//Scale2x twice
+	XBR2X,
+	XBR4X,		//xBR-lite twice
+	SCALER_NUMS
+};
+
+// Pixel art upscalers for frames of shade or palette indices. Indices are
+// only ever copied, never blended, so the output maps through the same
+// palette as the input. Rows are split in bands over an optional thread
+// pool. One Scaler scales one frame at a time; give each instance its own
+// and share the pool.
+class Scaler
+{
+public:
+	Scaler(SCALER type, int width, int height, ThreadPool* pool = nullptr);
+	int factor() const { return scale; }
+	int output_width() const { return width * scale; }
+	int output_height() const { return height * scale; }
+	// src is width x height, dst output_width() x output_height(), both unpadded
+	void run(const uint8_t* src, uint8_t* dst);
+
+	static const char* name(SCALER type);
+	static bool parse(const char* str, SCALER& type);
+private:
+	enum class PASS { SCALE2X, SCALE3X, XBR2X };
+	struct Image {
+		int width = 0;
+		int height = 0;
+		size_t pitch = 0;
+		std::vector<uint8_t> pixels;
+		uint8_t* row(int y) { return &pixels[(y + SCALER_PAD) * pitch + SCALER_PAD]; }
+		void resize(int w, int h);
+		void pad();
+	};
+	static int pass_factor(PASS pass) { return pass == PASS::SCALE3X ? 3 : 2; }
+	static void xbr2x_row(Image& src, int y, uint8_t* out, size_t pitch);
+	void run_pass(PASS pass, Image& src, uint8_t* dst, size_t pitch);
+
+	int width;
+	int height;
+	int scale = 1;
+	ThreadPool* pool;
+	std::vector<PASS> passes;
+	std::vector<Image> images;	//padded input of each pass
+};
@@ -0,0 +1,38 @@
+#include "Scheduler.h"
+
+void Scheduler::set_callback(EVENTS event, EVENT_HANDLER callback) {
+	callbacks[static_cast<int>(event)] = callback;
+}
+
+void Scheduler::schedule(EVENTS event, uint64_t at) {
+	deadlines[static_cast<int>(event)] = at;
+	if (at < next) next = at;
+	else update_next();
+}
+
+void Scheduler::cancel(EVENTS event) {
+	deadlines[static_cast<int>(event)] = NEVER;
+	update_next();
+}
+
+// only a handful of events, a linear scan is cheaper than keeping a heap
+void Scheduler::update_next() {
+	next = NEVER;
+	for (uint64_t d : deadlines) {
+		if (d < next) next = d;
+	}
+}
+
+// run every event that is due, earliest first. callbacks may schedule again
+void Scheduler::dispatch() {
+	while (next <= now) {
+		int event = 0;
+		for (int i = 1; i < static_cast<int>(EVENTS::EVENT_NUMS); i++) {
+			if (deadlines[i] < deadlines[event]) event = i;
+		}
+		const uint64_t at = deadlines[event];
+		deadlines[event] = NEVER;
+		update_next();
+		callbacks[event](at);
+	}
+}
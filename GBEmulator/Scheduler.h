@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+
+enum class EVENTS {
+	LCD_LINE,
+	TIMER,
+	OAM_DMA,
+	EVENT_NUMS
+};
+
+// Cycle based event scheduler. It owns the emulated clock and keeps one
+// deadline per event; the CPU only compares the clock with the earliest
+// deadline and calls dispatch() when it is reached.
+class Scheduler
+{
+public:
+	// called with the cycle the event was scheduled for, which may be
+	// slightly before now
+	typedef std::function<void(uint64_t)> EVENT_HANDLER;
+	static const uint64_t NEVER = UINT64_MAX;
+
+	uint64_t now = 0;
+	uint64_t next_event() const { return next; }
+	uint64_t deadline(EVENTS event) const { return deadlines[static_cast<int>(event)]; }
+	void set_callback(EVENTS event, EVENT_HANDLER callback);
+	void schedule(EVENTS event, uint64_t at);
+	void cancel(EVENTS event);
+	void dispatch();
+private:
+	uint64_t next = NEVER;
+	uint64_t deadlines[static_cast<int>(EVENTS::EVENT_NUMS)] = { NEVER, NEVER, NEVER };
+	EVENT_HANDLER callbacks[static_cast<int>(EVENTS::EVENT_NUMS)];
+	void update_next();
+};
@@ -0,0 +1,54 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned threads) {
+	for (unsigned i = 0; i < threads; i++) workers.emplace_back(&ThreadPool::work_loop, this);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto& worker : workers) worker.join();
+}
+
+void ThreadPool::parallel_for(size_t count, size_t bands, const BAND& band) {
+	if (bands > count) bands = count;
+	if (bands <= 1 || workers.empty()) {
+		if (count) band(0, count);
+		return;
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	size_t remaining = bands;
+	for (size_t i = 0; i < bands; i++)
+		jobs.push_back(Job{ &band, count * i / bands, count * (i + 1) / bands, &remaining });
+	wake.notify_all();
+	// help until the queue is empty, then wait for the bands still running.
+	// bands of other callers may be picked up on the way
+	while (remaining) {
+		if (!run_one(guard)) finished.wait(guard);
+	}
+}
+
+// run the next queued band with the lock released, false if there is none
+bool ThreadPool::run_one(std::unique_lock<std::mutex>& guard) {
+	if (jobs.empty()) return false;
+	Job job = jobs.front();
+	jobs.pop_front();
+	guard.unlock();
+	(*job.band)(job.begin, job.end);
+	guard.lock();
+	if (--*job.remaining == 0) finished.notify_all();
+	return true;
+}
+
+void ThreadPool::work_loop() {
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		if (run_one(guard)) continue;
+		if (stopping) return;
+		wake.wait(guard);
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for splitting work into bands. Any number of
+// threads may call parallel_for at once; each caller works on its own bands
+// too, so a busy pool slows callers down but never blocks them.
+class ThreadPool
+{
+public:
+	typedef std::function<void(size_t begin, size_t end)> BAND;
+	// threads: workers besides the calling thread
+	explicit ThreadPool(unsigned threads);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned size() const { return static_cast<unsigned>(workers.size()); }
+	// run band over [0, count) split in up to bands pieces, returns when all are done
+	void parallel_for(size_t count, size_t bands, const BAND& band);
+private:
+	struct Job {
+		const BAND* band;
+		size_t begin;
+		size_t end;
+		size_t* remaining;	//bands of the call still running, guarded by lock
+	};
+	void work_loop();
+	bool run_one(std::unique_lock<std::mutex>& guard);
+
+	std::deque<Job> jobs;
+	std::mutex lock;
+	std::condition_variable wake;		//jobs queued or stopping
+	std::condition_variable finished;	//a call's last band is done
+	bool stopping = false;
+	std::vector<std::thread> workers;
+};